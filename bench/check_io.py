@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Checks that anyopt reads its input from stdin and routes its outputs with --out like it writes files.
+
+Every check compiles the same module and compares what arrives on stdout, stderr or a descriptor handed down with
+fd:N against the output of a plain run. Outputs that share a descriptor have to arrive one after the other, and
+stderr has to stay open after an output was routed to it."""
+
+import argparse
+import gzip
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def run(cmd, workdir, stdin=None, pass_fds=()):
+    return subprocess.run(cmd, check=True, cwd=workdir, input=stdin, capture_output=True, pass_fds=pass_fds)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--anyopt", required=True, help="anyopt executable")
+    parser.add_argument("--input", required=True, help="corpus module")
+    parser.add_argument("--workdir", default=".", help="directory for anyopt's outputs")
+    parser.add_argument("--gzip", action="store_true", help="also read a gzip compressed module from stdin")
+    args = parser.parse_args()
+
+    os.makedirs(args.workdir, exist_ok=True)
+    input = os.path.abspath(args.input)
+    with open(input, "rb") as file:
+        module = file.read()
+
+    c = run([args.anyopt, input, "--emit-c", "--out", "c=-"], args.workdir).stdout
+    ll = run([args.anyopt, input, "--emit-llvm", "--out", "ll=-"], args.workdir).stdout
+
+    failed = False
+
+    def check(name, actual, expected):
+        nonlocal failed
+        status = "ok" if actual == expected else "MISMATCH"
+        if actual != expected:
+            failed = True
+        print("{}: {}".format(name, status))
+
+    check("stdin", run([args.anyopt, "-", "--emit-llvm", "--out", "ll=-"], args.workdir, stdin=module).stdout, ll)
+    if args.gzip:
+        check("stdin-gz", run([args.anyopt, "-", "--emit-llvm", "--out", "ll=-"], args.workdir, stdin=gzip.compress(module)).stdout, ll)
+
+    #C is emitted before LLVM IR, the second output must still find stderr open.
+    stderr = run([args.anyopt, input, "--emit-c", "--emit-llvm", "--out", "c=fd:2", "--out", "ll=fd:2"], args.workdir).stderr
+    check("stderr-shared", c in stderr and ll in stderr and stderr.index(c) < stderr.index(ll), True)
+
+    with tempfile.TemporaryFile(dir=args.workdir) as file:
+        fd = file.fileno()
+        run([args.anyopt, input, "--emit-c", "--emit-llvm", "--out", "c=fd:{}".format(fd), "--out", "ll=fd:{}".format(fd)],
+            args.workdir, pass_fds=(fd,))
+        file.seek(0)
+        check("fd-shared", file.read(), c + ll)
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
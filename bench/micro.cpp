@@ -0,0 +1,75 @@
+#include "anyopt/generator.h"
+#include "anyopt/typetable.h"
+#include "anyopt/irbuilder.h"
+
+#include<benchmark/benchmark.h>
+
+using namespace anyopt;
+
+static json generate (size_t defs, size_t types, int version) {
+    GeneratorOptions opts;
+    opts.defs = defs;
+    opts.types = types;
+    opts.version = version;
+    return generate_module(opts);
+}
+
+//Every iteration loads into a fresh world. Setting it up and tearing the previous one down is not timed.
+struct Fixture {
+    std::unique_ptr<thorin::Thorin> thorin;
+    thorin::World::Externals extern_globals;
+    TypeCache type_cache;
+    DefCache def_cache;
+    std::unique_ptr<TypeTable> table;
+    json type_table;
+
+    Fixture() : thorin(std::make_unique<thorin::Thorin>("bench")), table(std::make_unique<TypeTable>(*thorin, type_cache)) {}
+};
+
+static void BM_ReconstructTypes (benchmark::State& state, int version) {
+    auto module = generate(0, state.range(0), version);
+    size_t types = module["type_table"].size();
+
+    std::unique_ptr<Fixture> fixture;
+    for (auto _ : state) {
+        state.PauseTiming();
+        fixture.reset();
+        fixture = std::make_unique<Fixture>();
+        fixture->type_table = module["type_table"];
+        state.ResumeTiming();
+
+        fixture->table->reconstruct_types(fixture->type_table, version);
+    }
+
+    state.SetItemsProcessed(state.iterations() * types);
+    state.SetComplexityN(types);
+}
+BENCHMARK_CAPTURE(BM_ReconstructTypes, v1, 1)->RangeMultiplier(4)->Range(64, 16384)->Unit(benchmark::kMicrosecond)->Complexity();
+BENCHMARK_CAPTURE(BM_ReconstructTypes, v2, 2)->RangeMultiplier(4)->Range(64, 16384)->Unit(benchmark::kMicrosecond)->Complexity();
+
+//Version 2 defs are looked up by position, version 1 defs by name. The names of a version 2 module are not registered.
+static void BM_ReconstructDefs (benchmark::State& state, int version) {
+    auto module = generate(state.range(0), 32, version);
+    size_t defs = module["defs"].size();
+
+    std::unique_ptr<Fixture> fixture;
+    for (auto _ : state) {
+        state.PauseTiming();
+        fixture.reset();
+        fixture = std::make_unique<Fixture>();
+        fixture->type_table = module["type_table"];
+        fixture->table->reconstruct_types(fixture->type_table, version);
+        json def_list = module["defs"];
+        state.ResumeTiming();
+
+        IRBuilder irbuilder(*fixture->thorin, *fixture->table, fixture->extern_globals, fixture->def_cache);
+        irbuilder.reconstruct_defs(def_list, version);
+    }
+
+    state.SetItemsProcessed(state.iterations() * defs);
+    state.SetComplexityN(defs);
+}
+BENCHMARK_CAPTURE(BM_ReconstructDefs, v1, 1)->RangeMultiplier(4)->Range(1024, 262144)->Unit(benchmark::kMillisecond)->Complexity();
+BENCHMARK_CAPTURE(BM_ReconstructDefs, v2, 2)->RangeMultiplier(4)->Range(1024, 262144)->Unit(benchmark::kMillisecond)->Complexity();
+
+BENCHMARK_MAIN();
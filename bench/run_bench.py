@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Runs anyopt on one corpus module (or several files compiled together) and compares its --time-report against a stored baseline.
+
+The benchmark fails when load, pass, codegen or teardown time, or the peak memory use, exceeds the baseline by more than
+the threshold. A benchmark without a baseline exits with SKIP_RETURN_CODE, which CTest reports as skipped rather than passed.
+--update records the current numbers instead.
+
+The startup configuration compiles a module at -O0 to C and LLVM IR and tracks the time to the first pass and the
+time until anyopt exits against the baseline."""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+METRICS = ["load", "passes", "codegen", "teardown", "max_rss_kb"]
+STARTUP_METRICS = ["first_pass", "exit"]
+
+# Registered as SKIP_RETURN_CODE of the benchmark tests.
+SKIP_RETURN_CODE = 77
+
+# Differences below these are noise on any machine and never fail a benchmark.
+MIN_DELTA = {"load": 0.005, "passes": 0.005, "codegen": 0.005, "teardown": 0.005, "max_rss_kb": 1024, "first_pass": 0.002, "exit": 0.002}
+
+
+def default_passes(anyopt):
+    output = subprocess.run([anyopt, "--passes"], check=True, capture_output=True, text=True).stdout
+    return output.split()
+
+
+def command(anyopt, inputs, config):
+    if config == "passes":
+        flags = default_passes(anyopt)
+    elif config in ["O0", "O1", "O2", "O3"]:
+        flags = ["-" + config]
+    elif config == "startup":
+        return [anyopt] + [os.path.abspath(input) for input in inputs] + ["-O0", "--emit-c", "--emit-llvm"]
+    else:
+        sys.exit("unknown configuration " + config)
+    return [anyopt] + [os.path.abspath(input) for input in inputs] + flags + ["--emit-llvm"]
+
+
+def measure(cmd, workdir, repeat, metrics):
+    """Best of repeat runs for every metric, which is the most stable number on a busy machine."""
+    best = {}
+    for i in range(repeat):
+        report = os.path.join(workdir, "time-report.json")
+        start = time.perf_counter()
+        subprocess.run(cmd + ["--time-report", report], check=True, cwd=workdir, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        elapsed = time.perf_counter() - start
+        with open(report) as file:
+            data = json.load(file)
+        data["exit"] = elapsed
+        for metric in metrics:
+            best[metric] = min(best.get(metric, data[metric]), data[metric])
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--anyopt", required=True, help="anyopt executable")
+    parser.add_argument("--input", required=True, nargs="+", help="corpus module, or the files of a multi-file input")
+    parser.add_argument("--name", help="name of the benchmark, defaults to the name of the first input")
+    parser.add_argument("--config", default="passes", help="passes (the normal pass chain), O0 to O3 or startup")
+    parser.add_argument("--baseline", required=True, help="JSON file with the baselines of all benchmarks")
+    parser.add_argument("--threshold", type=float, default=0.25, help="allowed relative regression")
+    parser.add_argument("--repeat", type=int, default=3, help="number of runs")
+    parser.add_argument("--workdir", default=".", help="directory for anyopt's outputs")
+    parser.add_argument("--update", action="store_true", help="store the current numbers as the baseline")
+    args = parser.parse_args()
+
+    name = (args.name or os.path.splitext(os.path.basename(args.input[0]))[0]) + "-" + args.config
+    os.makedirs(args.workdir, exist_ok=True)
+    metrics = STARTUP_METRICS if args.config == "startup" else METRICS
+    current = measure(command(args.anyopt, args.input, args.config), args.workdir, args.repeat, metrics)
+
+    baselines = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as file:
+            baselines = json.load(file)
+
+    if args.update:
+        baselines[name] = current
+        with open(args.baseline, "w") as file:
+            json.dump(baselines, file, indent=4, sort_keys=True)
+            file.write("\n")
+        print("{}: baseline updated {}".format(name, current))
+        return 0
+
+    if name not in baselines:
+        print("{}: NO BASELINE in {}, measured {} (record one with --update)".format(name, args.baseline, current))
+        return SKIP_RETURN_CODE
+
+    failed = False
+    for metric in metrics:
+        if metric not in baselines[name]:
+            print("{}: {} {} (no baseline)".format(name, metric, current[metric]))
+            continue
+        base = baselines[name][metric]
+        limit = max(base * (1 + args.threshold), base + MIN_DELTA[metric])
+        status = "ok"
+        if current[metric] > limit:
+            status = "REGRESSION"
+            failed = True
+        print("{}: {} {} (baseline {}, limit {:.4g}) {}".format(name, metric, current[metric], base, limit, status))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,9 +5,27 @@
 
 #include<thorin/def.h>
 
+#include<unordered_map>
+
 namespace anyopt {
 
+struct WorldStats {
+    size_t continuations = 0;
+    size_t primops = 0;
+};
+
+WorldStats world_stats(thorin::World& world);
+/// Number of defs in the scope of every external continuation with a body.
+std::map<std::string, size_t> scope_sizes(thorin::World& world);
+
+/// Maps defs back to the names they were given in the input files.
+typedef std::unordered_map<const thorin::Def*, std::string> DefNames;
+void add_def_names(DefNames& names, IRBuilder& irbuilder);
+
 void print_scope_analysis(IRBuilder& irbuilder, std::string entry_name);
+/// Sizes, loop nesting depth and outgoing calls of the scopes of the given external continuations, or of all of them if entries is empty.
+/// The scopes are built one after another, their statistics are computed on up to jobs threads.
+json analyze_scopes(thorin::World& world, const std::vector<std::string>& entries, const DefNames& names, size_t jobs);
 
 }
 
@@ -0,0 +1,13 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include<string>
+
+namespace anyopt {
+
+/// SHA-256 of data as 64 lowercase hex digits.
+std::string sha256 (const std::string& data);
+
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include<nlohmann/json.hpp>
+
+#include<cstdint>
+#include<string>
+#include<vector>
+
+using json = nlohmann::json;
+
+namespace anyopt {
+
+struct GeneratorOptions {
+    std::string module = "generated";
+    /// Approximate number of defs in the module.
+    size_t defs = 1000;
+    /// Nesting depth of the blocks below each function's entry.
+    size_t depth = 3;
+    /// Number of successors of every block above the maximum depth.
+    size_t fanout = 2;
+    /// Minimum number of entries in the type table.
+    size_t types = 32;
+    /// Fraction of the functions that are copies of an earlier function. Within one file a copy gets a new name,
+    /// with several files it is the same external function (same name and body) as in an earlier file.
+    double dup_ratio = 0;
+    /// Number of input files the defs are spread over.
+    size_t files = 1;
+    uint64_t seed = 1;
+    /// Schema version of the generated files, 1 or 2. The loader only deduplicates top level definitions across version 1 files.
+    int version = 1;
+};
+
+/// Generates a valid input module made of external functions with random bodies, in the schema version opts.version.
+/// Every def kind in deftable.h and every type kind in tables/typetable.h occurs in it at least once.
+json generate_module (const GeneratorOptions& opts);
+
+/// Generates opts.files input files of one module, each with its own type table and about opts.defs / opts.files defs,
+/// as a multi file build would. Duplicates are repeated across files, which exercises the loader's top level deduplication.
+std::vector<json> generate_modules (const GeneratorOptions& opts);
+
+/// Rewrites a version 1 module into the version 2 schema, with the def names in "names".
+json to_version2 (const json& module);
+
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef HEAP_TO_STACK_H
+#define HEAP_TO_STACK_H
+
+#include<thorin/world.h>
+
+#include<cstddef>
+
+namespace anyopt {
+
+/// Turns allocs of fixed-size types up to limit bytes (see --heap-to-stack-limit) into slots, if the address never leaves the scope of the function:
+/// it may only be loaded from and stored to, directly or through lea chains. Only loads and stores in the function's own basic blocks
+/// count, the entry and continuations reached from it by jumps, branches or as return continuations: a nested lambda or closure
+/// of the scope may run after the function returned and is left alone, as are allocs inside one. Each slot gets its own enter, run hoist_enters afterwards
+/// to merge them into the function's frame. Prints the allocs promoted. Returns whether any alloc was moved, the allocs are left behind
+/// unused for a cleanup to remove.
+bool heap_to_stack(thorin::Thorin& thorin, size_t limit);
+
+}
+
+#endif
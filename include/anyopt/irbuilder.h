@@ -8,21 +8,91 @@
 #include<thorin/world.h>
 #include<nlohmann/json.hpp>
 #include<map>
+#include<set>
+#include<string_view>
 
 using json = nlohmann::json;
 
 namespace anyopt {
 
+/// A def description as the builders read it. Version 1 defs and the keyed version 2 defs are objects, the hot version 2 defs
+/// are positional arrays ["kind", fields...] whose fields are read through their layout in DefLayoutV2Enum.
+/// Version 1 defs are identified by their "name", version 2 defs by their position in "defs".
+class DefDesc {
+public:
+    DefDesc(const json& desc) : desc_(desc) {}
+    DefDesc(const json& desc, size_t position);
+
+    const json& operator[] (const char* field) const;
+    bool contains (const char* field) const;
+    const json& kind () const { return layout_ ? desc_[0] : desc_["type"]; }
+
+    bool positional () const { return indexed_; }
+    size_t position () const { return position_; }
+    const json& name () const { return desc_["name"]; }
+
+    /// Calls f with the name and the value of every field but the kind.
+    template<class F>
+    void for_each_field (F f) const {
+        if (layout_) {
+            for (size_t i = 0; i < layout_->size(); ++i)
+                f(std::string_view((*layout_)[i]), desc_[i + 1]);
+            return;
+        }
+        for (auto& item : desc_.items()) {
+            if (item.key() != "type")
+                f(std::string_view(item.key()), item.value());
+        }
+    }
+
+private:
+    const json& desc_;
+    const std::vector<const char*>* layout_ = nullptr;
+    size_t position_ = 0;
+    bool indexed_ = false;
+};
+
+/// Module wide record of the top level definitions (external continuations and globals) built so far, keyed by their external name.
+/// A later file that carries a structurally identical definition reuses the recorded def instead of rebuilding it.
+class DefCache {
+public:
+    struct Entry {
+        size_t hash;
+        const thorin::Def* def;
+    };
+
+    bool enabled = false;
+    std::map<std::string, Entry> top_level;
+
+    size_t reused = 0;
+    size_t skipped = 0;
+    size_t total = 0;
+};
+
 class IRBuilder {
 public:
-    IRBuilder(thorin::Thorin& thorin, TypeTable& typetable, thorin::World::Externals& extern_globals) : thorin_(thorin), typetable_(typetable), extern_globals_(extern_globals) {}
+    IRBuilder(thorin::Thorin& thorin, TypeTable& typetable, thorin::World::Externals& extern_globals, DefCache& def_cache) : thorin_(thorin), typetable_(typetable), extern_globals_(extern_globals), def_cache_(def_cache) {}
 
 private:
     thorin::Thorin& thorin_;
     TypeTable& typetable_;
     thorin::World::Externals& extern_globals_;
+    DefCache& def_cache_;
 
     std::map<std::string, const thorin::Def*> known_defs;
+    std::vector<const thorin::Def*> indexed_defs;
+
+    //Per file index of the def descriptions, used to hash top level definitions.
+    std::map<std::string, std::vector<size_t>> def_index;
+    std::map<std::string, std::pair<std::string, size_t>> param_index;
+    std::map<std::string, size_t> closed_hashes;
+    std::map<std::string, std::pair<size_t, size_t>> open_hashes;
+    std::vector<std::string> hash_stack;
+
+    //Descriptions of the file that is currently loaded, and the positions that were already built.
+    json* pending_defs_ = nullptr;
+    int version_ = 1;
+    std::set<size_t> built_positions;
 
     enum class DefType {
 #define ID(_, A) A,
@@ -35,11 +105,26 @@ private:
     thorin::MathOpTag resolve_mathop_tag (std::string mathop_tag);
     thorin::CmpTag resolve_cmp_tag (std::string cmp_tag);
 
-    thorin::Array<const thorin::Def*> get_arglist (json arg_list);
+    thorin::Array<const thorin::Def*> get_arglist (const json& arg_list);
+
+    void index_defs (json& defs);
+    const thorin::Def* find_def (size_t position);
+    const thorin::Def* find_def (const std::string& name);
+    const thorin::Def* find_def (const DefDesc& desc);
+    const thorin::Def*& def_slot (const DefDesc& desc);
+    bool build_pending (const std::vector<size_t>& positions);
+    thorin::Continuation* declare_continuation (const DefDesc& desc);
+    void define_continuation (thorin::Continuation* continuation, const DefDesc& desc);
+
+    bool is_operand_field (DefType kind, std::string_view field);
+    std::vector<const json*> operand_refs (const DefDesc& desc);
+    std::vector<std::string> operand_names (const json& desc);
+    size_t hash_def (json& defs, const std::string& name, size_t& low);
+    std::set<size_t> dedup_top_level (json& defs, std::map<std::string, std::pair<std::string, size_t>>& roots);
 
     thorin::World& world() { return thorin_.world(); }
 
-#define CreateFunction(NAME, CLASS) const thorin::Def* build_##CLASS (json desc);
+#define CreateFunction(NAME, CLASS) const thorin::Def* build_##CLASS (const DefDesc& desc);
     DefTypeEnum(CreateFunction)
 #undef CreateFunction
 
@@ -48,7 +133,11 @@ public:
     std::map<std::string, const thorin::Def*>::iterator end() { return known_defs.end(); }
 
     const thorin::Def * get_def (std::string type_name);
-    const thorin::Def * reconstruct_def(json desc);
+    const thorin::Def * get_def (size_t position);
+    const thorin::Def * get_def (const json& def_ref);
+    const thorin::Def * reconstruct_def(const DefDesc& desc);
+    void reconstruct_defs(json& defs, int version = 1);
+    void register_names(json& names);
 };
 
 }
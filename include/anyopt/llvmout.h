@@ -0,0 +1,27 @@
+#ifndef LLVMOUT_H
+#define LLVMOUT_H
+
+#include<iostream>
+#include<string>
+
+namespace llvm { class Module; }
+
+namespace anyopt {
+
+enum class ModuleFormat {
+    Text,
+    Bitcode,
+    Object,
+};
+
+/// File extension of a module format (".ll", ".bc" or ".o").
+const char* module_format_extension (ModuleFormat format);
+
+/// Writes module to out as textual IR, bitcode, or a native object file. Objects are generated for the module's target triple
+/// with a target machine for cpu and attr (the host cpu if cpu is empty), optimizing at the given -O level.
+/// Returns false if no target machine can be created for the module.
+bool write_module (llvm::Module& module, std::ostream& out, ModuleFormat format, int opt_level, const std::string& cpu, const std::string& attr);
+
+}
+
+#endif
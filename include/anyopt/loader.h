@@ -0,0 +1,34 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include "anyopt/typetable.h"
+#include "anyopt/irbuilder.h"
+
+#include<functional>
+
+namespace anyopt {
+
+/// Loads one or more input modules into a single world.
+/// The type and def caches are shared by all files loaded through the same Loader.
+class Loader {
+public:
+    Loader(thorin::Thorin& thorin) : thorin_(thorin) {}
+
+    /// Reconstructs the types and defs of data. inspect is called with the file's IRBuilder once it is complete.
+    bool load(json& data, const std::string& filename, std::function<void(IRBuilder&)> inspect = {});
+
+    DefCache& def_cache() { return def_cache_; }
+
+    /// Points the caches at the world a cleanup put in place of the one the files were loaded into.
+    void rebind();
+
+private:
+    thorin::Thorin& thorin_;
+    thorin::World::Externals extern_globals_;
+    TypeCache type_cache_;
+    DefCache def_cache_;
+};
+
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef MULTIISA_H
+#define MULTIISA_H
+
+#include "anyopt/llvmout.h"
+#include "anyopt/stream.h"
+
+#include<thorin/world.h>
+
+#include<string>
+#include<vector>
+
+namespace anyopt {
+
+/// Runs the CPU backend once for every cpu in cpus and writes <module>.<cpu>.ll/.bc/.o (one file per format), with every defined external function renamed to <name>_<cpu>
+/// (with characters other than letters and digits replaced by underscores).
+/// Externally visible globals are only defined in the first variant. <module>.dispatch.c then defines the original names as ifuncs that resolve
+/// to the variant of the last cpu that the running machine supports, the first cpu is the fallback.
+/// The variants are emitted from the world one after another, and then optimized and written on up to jobs threads, each with its own LLVMContext.
+/// Returns false if a cpu is unknown to the dispatcher or an output cannot be written.
+bool emit_multi_isa (thorin::Thorin& thorin, const std::vector<std::string>& cpus, int opt_level, bool debug,
+                     const std::string& host_triple, const std::string& host_attr, const std::string& module_name,
+                     const std::vector<ModuleFormat>& formats, Compression compression, size_t jobs);
+
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include<cstddef>
+#include<functional>
+
+namespace anyopt {
+
+/// Connects to the GNU make jobserver named in MAKEFLAGS, if any. Has to run before the process opens any file itself,
+/// so that the descriptors make passed down cannot be confused with anyopt's own. parallel_for connects on its own otherwise.
+void connect_jobserver ();
+
+/// Number of workers used when none was requested, i.e. the number of hardware threads.
+size_t default_jobs ();
+
+/// Calls body(i) for every i in [0, n) on up to jobs threads, the calling thread included.
+/// Indices are handed out one at a time, so uneven work items balance out. body must synchronise access to shared state itself.
+/// If MAKEFLAGS names a GNU make jobserver (a fifo or a pipe), every thread beyond the calling one first takes a token from it,
+/// and returns it when it is done. Without a jobserver, jobs alone decides.
+void parallel_for (size_t n, size_t jobs, const std::function<void(size_t)>& body);
+
+}
+
+#endif
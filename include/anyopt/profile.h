@@ -0,0 +1,54 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "anyopt/irbuilder.h"
+
+#include<thorin/world.h>
+#include<thorin/transform/importer.h>
+
+#include<cstdint>
+#include<map>
+#include<set>
+#include<string>
+#include<unordered_map>
+
+namespace anyopt {
+
+/// Execution counts of the continuations of one world. Passes that rebuild the world carry them over with import_counts,
+/// copies that passes make within a world (lower2cff, the inliners) have no count.
+typedef std::unordered_map<const thorin::Continuation*, uint64_t> ContinuationCounts;
+
+/// Runtime execution counts of continuations by name, see --profile.
+/// External continuations are keyed by their external name, all others by their def name in the input. When several files are
+/// loaded, internal continuations need the key <file>:<def name>, a plain def name would match in every file.
+class Profile {
+public:
+    /// Reads a JSON object that maps names to counts.
+    bool load(const std::string& filename);
+    /// Adds the counts of the profiled continuations irbuilder has built from filename to counts.
+    void attach(IRBuilder& irbuilder, const std::string& filename, bool several_files, ContinuationCounts& counts);
+
+    bool empty() const { return counts_.empty(); }
+    size_t size() const { return counts_.size(); }
+    /// Number of profile entries that matched a continuation so far.
+    size_t matched() const { return matched_.size(); }
+    uint64_t max_count() const { return max_count_; }
+
+    /// Fraction of the hottest count from which a call site is hot, see --profile-hot.
+    double hot_fraction = 0.01;
+
+private:
+    std::map<std::string, uint64_t> counts_;
+    std::set<std::string> matched_;
+    uint64_t max_count_ = 0;
+};
+
+/// The counts of the continuations importer has copied, keyed by their copies. Continuations it did not import are dropped.
+ContinuationCounts import_counts(const ContinuationCounts& counts, const thorin::Importer& importer);
+
+/// Inlines the returning callee of every hot call site and leaves cold ones alone. Prints every decision it makes.
+void pgo_inline(thorin::Thorin& thorin, const Profile* profile, const ContinuationCounts& counts);
+
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef PROMOTE_GLOBALS_H
+#define PROMOTE_GLOBALS_H
+
+#include<thorin/world.h>
+
+namespace anyopt {
+
+/// Makes every internal mutable global immutable if its address is only ever loaded from, directly or through lea chains.
+/// Loads at constant indices from globals with constant initializers (literals, arrays, structs, tuples, vectors) are replaced by the value.
+/// Prints the globals promoted and the number of loads folded. Returns whether any global was promoted, the mutable ones are left
+/// behind unused for a cleanup to remove.
+bool promote_const_globals(thorin::Thorin& thorin);
+
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include<iostream>
+#include<memory>
+#include<string>
+
+namespace anyopt {
+
+enum class Compression {
+    None,
+    Gzip,
+    Zstd,
+};
+
+/// Compression that belongs to a file extension (".gz", ".zst"), or None.
+Compression compression_from_extension (const std::string& filename);
+/// File extension that belongs to a compression, or an empty string.
+const char* compression_extension (Compression compression);
+
+/// Opens filename for reading, "-" reads stdin. Gzip and zstd compressed files are detected by their magic bytes and decompressed on the fly.
+/// Returns nullptr if the file cannot be opened or its compression is not supported by this build.
+std::unique_ptr<std::istream> open_input (const std::string& filename);
+
+/// Opens filename for writing, compressing everything written to it with the given compression. Writes are buffered in large blocks.
+/// "-" writes to stdout and "fd:N" to the already open file descriptor N, which is closed when the stream is destroyed.
+/// Descriptors 0 to 2 are never closed, and neither is one that another output announced with expect_output still writes to.
+/// Returns nullptr if the file cannot be opened or the compression is not supported by this build.
+std::unique_ptr<std::ostream> open_output (const std::string& filename, Compression compression = Compression::None);
+
+/// Announces that filename will be opened with open_output, so that several outputs can share one "fd:N".
+void expect_output (const std::string& filename);
+
+/// Whether open_output writes filename to stdout or a file descriptor instead of a file on disk.
+bool is_stream_target (const std::string& filename);
+
+}
+
+#endif
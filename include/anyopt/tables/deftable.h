@@ -38,4 +38,28 @@ N("variant_extract", VariantExtract) \
 N("variant_index", VariantIndex) \
 N("assembly", Assembly) \
 
+// Version 2 of the input schema refers to defs and types by their position in "defs" and "type_table" instead of by name.
+// A param is referred to as [continuation, index]. Debug names are optional and live in a separate "names" object.
+// The hot def kinds below are written as positional arrays ["kind", fields...], all other defs stay keyed objects.
+#define DefLayoutV2Enum(N) \
+N("arithop", "op", "args") \
+N("mathop", "op", "args") \
+N("cmp", "op", "args") \
+N("const", "const_type", "value") \
+N("top", "const_type") \
+N("bottom", "const_type") \
+N("lea", "args") \
+N("load", "args") \
+N("store", "args") \
+N("extract", "args") \
+N("insert", "args") \
+N("select", "args") \
+N("tuple", "args") \
+N("vector", "args") \
+N("cast", "target_type", "source") \
+N("bitcast", "target_type", "source") \
+N("enter", "mem") \
+N("slot", "target_type", "frame") \
+N("alloc", "target_type", "args") \
+
 #endif
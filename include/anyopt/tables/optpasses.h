@@ -1,23 +1,27 @@
 #ifndef TABLES_OPTPASSES_H
 #define TABLES_OPTPASSES_H
 
-#define ThorinWorldAdapter(pass) [](thorin::Thorin& thorin) { pass(thorin.world()); }
+#define ThorinWorldAdapter(pass) [](thorin::Thorin& thorin, PassContext&) { pass(thorin.world()); }
+#define ThorinAdapter(pass) [](thorin::Thorin& thorin, PassContext&) { pass(thorin); }
 
 #define OptPassesEnum(N) \
 N(Verify, verify, ThorinWorldAdapter(verify)) \
-N(Cleanup, cleanup, [](thorin::Thorin& thorin){ thorin.cleanup(); }) \
-N(Lower2CFF, lower2cff, lower2cff) \
-N(PE, pe, pe) \
-N(Mark_PE_Done, mark_pe_done, mark_pe_done) \
-N(Flatten_Tuples, flatten_tuples, flatten_tuples) \
-N(Split_Slots, split_slots, split_slots) \
+N(Cleanup, cleanup, [](thorin::Thorin& thorin, PassContext& context) { cleanup_world(thorin, context.counts); }) \
+N(Lower2CFF, lower2cff, ThorinAdapter(lower2cff)) \
+N(PE, pe, ThorinAdapter(pe)) \
+N(Mark_PE_Done, mark_pe_done, ThorinAdapter(mark_pe_done)) \
+N(Flatten_Tuples, flatten_tuples, ThorinAdapter(flatten_tuples)) \
+N(Split_Slots, split_slots, ThorinAdapter(split_slots)) \
 N(Closure_Conversion, closure_conversion, ThorinWorldAdapter(closure_conversion)) \
-N(Lift_Builtins, lift_builtins, lift_builtins) \
-N(Inliner, inliner, inliner) \
-N(Hoist_Enters, hoist_enters, hoist_enters) \
+N(Lift_Builtins, lift_builtins, ThorinAdapter(lift_builtins)) \
+N(Inliner, inliner, ThorinAdapter(inliner)) \
+N(PGO_Inline, pgo_inline, [](thorin::Thorin& thorin, PassContext& context) { pgo_inline(thorin, context.profile, context.counts); }) \
+N(Promote_Const_Globals, promote_const_globals, [](thorin::Thorin& thorin, PassContext& context) { if (promote_const_globals(thorin)) cleanup_world(thorin, context.counts); }) \
+N(Heap_To_Stack, heap_to_stack, [](thorin::Thorin& thorin, PassContext& context) { if (heap_to_stack(thorin, context.heap_to_stack_limit)) cleanup_world(thorin, context.counts); }) \
+N(Hoist_Enters, hoist_enters, ThorinAdapter(hoist_enters)) \
 N(Dead_Load_Opt, dead_load_opt, ThorinWorldAdapter(dead_load_opt)) \
-N(Codegen_Prepare, codegen_prepare, codegen_prepare) \
-N(Dump_Scoped, dump_scoped, [](thorin::Thorin& thorin) { thorin.world().dump_scoped(); }) \
-N(Dump, dump, [](thorin::Thorin& thorin) { thorin.world().dump(); }) \
+N(Codegen_Prepare, codegen_prepare, ThorinAdapter(codegen_prepare)) \
+N(Dump_Scoped, dump_scoped, [](thorin::Thorin& thorin, PassContext&) { thorin.world().dump_scoped(); }) \
+N(Dump, dump, [](thorin::Thorin& thorin, PassContext&) { thorin.world().dump(); }) \
 
 #endif
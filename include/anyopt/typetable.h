@@ -6,40 +6,81 @@
 #include<thorin/world.h>
 #include<nlohmann/json.hpp>
 #include<map>
+#include<unordered_map>
+#include<set>
 
 using json = nlohmann::json;
 
 namespace anyopt {
 
+enum class OptiType {
+#define ID(_, A) A,
+    TypeTableEnum(ID)
+#undef ID
+};
+
+/// Structural identity of a type: its kind, its already resolved operands and its remaining attributes (tag, length, address space).
+struct TypeKey {
+    OptiType kind;
+    std::vector<const thorin::Type*> args;
+    std::string attrs;
+
+    bool operator==(const TypeKey& other) const { return kind == other.kind && args == other.args && attrs == other.attrs; }
+};
+
+struct TypeKeyHash {
+    size_t operator()(const TypeKey& key) const;
+};
+
+/// Module wide type cache that outlives the per file TypeTables.
+/// Structural types are keyed by their TypeKey, nominal struct and variant types by their name and field names.
+class TypeCache {
+public:
+    std::unordered_map<TypeKey, const thorin::Type*, TypeKeyHash> structural;
+    std::map<std::pair<std::string, std::vector<std::string>>, thorin::NominalType*> nominal;
+    std::set<const thorin::Type*> complete;
+};
+
 class TypeTable {
 public:
-    TypeTable(thorin::Thorin& thorin) : thorin_(thorin) {}
+    TypeTable(thorin::Thorin& thorin, TypeCache& cache) : thorin_(thorin), cache_(cache) {}
 
 private:
     thorin::Thorin& thorin_;
+    TypeCache& cache_;
 
     std::map<std::string, const thorin::Type*> known_types;
+    std::vector<const thorin::Type*> indexed_types;
 
-    enum class OptiType {
-#define ID(_, A) A,
-        TypeTableEnum(ID)
-#undef ID
-    };
+    //Entries of the type table that is currently loaded, and the positions that were already built.
+    std::map<std::string, std::vector<size_t>> type_index;
+    json* pending_types_ = nullptr;
+    std::set<size_t> built_positions;
 
     OptiType resolvetype (std::string type_name);
     thorin::PrimTypeTag resolvetag (std::string type_tag);
     thorin::AddrSpace resolveaddrspace (std::string addr_space);
-    thorin::Array<const thorin::Type*> get_arglist (json arg_list);
+    thorin::Array<const thorin::Type*> get_arglist (const json& arg_list);
+
+    TypeKey structural_key (OptiType kind, const json& desc);
+    thorin::NominalType* build_nominal (OptiType kind, std::string nominal_name, const json& desc);
+    const thorin::Type* find_type (size_t position);
+    const thorin::Type* find_type (const json& name);
+    const thorin::Type*& type_slot (const json& name);
+    const thorin::Type* build_pending (const json& name, const std::vector<size_t>& positions);
 
     thorin::World& world() { return thorin_.world(); }
 
-#define CreateFunction(NAME, CLASS) const thorin::Type* build_##CLASS (json desc);
+#define CreateFunction(NAME, CLASS) const thorin::Type* build_##CLASS (const json& desc);
     TypeTableEnum(CreateFunction)
 #undef CreateFunction
 
 public:
     const thorin::Type * get_type(std::string type_name);
-    const thorin::Type * reconstruct_type(json desc);
+    const thorin::Type * get_type(size_t position);
+    const thorin::Type * get_type(const json& type_ref);
+    const thorin::Type * reconstruct_type(const json& desc);
+    void reconstruct_types(json& types, int version = 1);
 };
 
 }
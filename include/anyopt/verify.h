@@ -0,0 +1,37 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include<thorin/world.h>
+
+#include<cstdint>
+
+namespace anyopt {
+
+/// Verifies only what a pass created or rewrote: defs above the gid watermark of the previous pass, continuations whose body is above it,
+/// and their users.
+/// A full check runs at the given sampling rate, and whenever a pass replaced the whole world.
+/// The caller passes a generation that changes whenever the world may have been replaced, since a new world can reuse the old one's address.
+class IncrementalVerifier {
+public:
+    IncrementalVerifier(double full_rate) : full_rate_(full_rate) {}
+
+    void before(thorin::World& world, size_t generation);
+    bool after(thorin::World& world, size_t generation, const char* pass);
+
+    size_t checked = 0;
+    size_t total = 0;
+    size_t full_verifies = 0;
+
+private:
+    bool verify_def(thorin::World& world, const thorin::Def* def, const char* pass);
+
+    size_t generation_ = SIZE_MAX;
+    /// Largest gid of the world after the last pass, every def above it is new.
+    size_t max_gid_ = 0;
+    double full_rate_;
+    double credit_ = 0;
+};
+
+}
+
+#endif
@@ -1,19 +1,141 @@
 #include "anyopt/analysis.h"
+#include "anyopt/parallel.h"
 
 #include <thorin/analyses/scope.h>
+#include <thorin/analyses/looptree.h>
+
+#include <algorithm>
 
 namespace anyopt {
 
+WorldStats world_stats(thorin::World& world) {
+    WorldStats stats;
+    for (auto def : world.defs()) {
+        if (def->isa_nom<thorin::Continuation>())
+            stats.continuations++;
+        else if (def->isa<thorin::PrimOp>())
+            stats.primops++;
+    }
+    return stats;
+}
+
+std::map<std::string, size_t> scope_sizes(thorin::World& world) {
+    std::map<std::string, size_t> sizes;
+    for (auto& [name, def] : world.externals()) {
+        auto continuation = def->isa_nom<thorin::Continuation>();
+        if (continuation && continuation->has_body()) {
+            thorin::Scope scope(continuation);
+            sizes[name] = scope.defs().size();
+        }
+    }
+    return sizes;
+}
+
+void add_def_names(DefNames& names, IRBuilder& irbuilder) {
+    for (auto it : irbuilder)
+        names.emplace(it.second, it.first);
+}
+
 void print_scope_analysis(IRBuilder& irbuilder, std::string entry_name) {
     thorin::Continuation* entry = const_cast<thorin::Continuation*>(irbuilder.get_def(entry_name)->as<thorin::Continuation>());
     std::cerr << "Scope analysis for " << entry_name << "\n";
 
     thorin::Scope scope(entry);
 
-    for (auto it : irbuilder) {
-        if (scope.contains(it.second))
-            std::cout << it.first << "\n";
+    DefNames names;
+    add_def_names(names, irbuilder);
+
+    std::vector<std::string> members;
+    for (auto def : scope.defs()) {
+        auto name = names.find(def);
+        if (name != names.end())
+            members.push_back(name->second);
     }
+    std::sort(members.begin(), members.end());
+    for (auto& name : members)
+        std::cout << name << "\n";
+}
+
+json analyze_scopes(thorin::World& world, const std::vector<std::string>& entries, const DefNames& names, size_t jobs) {
+    std::vector<std::pair<std::string, thorin::Continuation*>> roots;
+    auto add_root = [&] (const std::string& name, thorin::Def* def) {
+        auto continuation = def->isa_nom<thorin::Continuation>();
+        if (continuation && continuation->has_body())
+            roots.emplace_back(name, continuation);
+    };
+    if (entries.empty()) {
+        for (auto& [name, def] : world.externals())
+            add_root(name, def);
+        std::sort(roots.begin(), roots.end());
+    } else {
+        for (auto& name : entries) {
+            if (auto def = world.externals().lookup(name))
+                add_root(name, *def);
+            else
+                std::cerr << "Warning: " << name << " is not an external definition" << std::endl;
+        }
+    }
+
+    std::unordered_map<const thorin::Def*, std::string> root_names;
+    for (auto& [name, continuation] : roots)
+        root_names.emplace(continuation, name);
+
+    //Scopes are built one after another: building one fills lazily computed state shared through the world
+    //(uses, CFA, CFG, loop trees), and Thorin makes no promise that this is safe from several threads.
+    //Only the members and the loop depth are taken from them, the statistics below only read the defs.
+    struct Members {
+        std::vector<const thorin::Def*> defs;
+        int loop_depth = 0;
+    };
+    std::vector<Members> members(roots.size());
+    for (size_t i = 0; i < roots.size(); ++i) {
+        thorin::Scope scope(roots[i].second);
+        auto& cfg = scope.f_cfg();
+        auto& looptree = cfg.looptree();
+        members[i].defs.assign(scope.defs().begin(), scope.defs().end());
+        for (auto def : scope.defs()) {
+            if (auto continuation = def->isa_nom<thorin::Continuation>()) {
+                if (auto node = cfg[continuation])
+                    members[i].loop_depth = std::max(members[i].loop_depth, looptree[node]->depth());
+            }
+        }
+    }
+
+    std::vector<json> reports(roots.size());
+    parallel_for(roots.size(), jobs, [&] (size_t i) {
+        size_t continuations = 0, primops = 0;
+        std::set<std::string> calls;
+        std::vector<std::string> def_names;
+        for (auto def : members[i].defs) {
+            if (def->isa_nom<thorin::Continuation>())
+                continuations++;
+            else if (def->isa<thorin::PrimOp>())
+                primops++;
+
+            //Other scopes are free in this one, so they show up as operands of its defs.
+            for (auto op : def->ops()) {
+                auto callee = root_names.find(op);
+                if (callee != root_names.end() && op != roots[i].second)
+                    calls.insert(callee->second);
+            }
+
+            auto name = names.find(def);
+            if (name != names.end())
+                def_names.push_back(name->second);
+        }
+        std::sort(def_names.begin(), def_names.end());
+
+        reports[i] = {
+            {"name", roots[i].first},
+            {"continuations", continuations},
+            {"primops", primops},
+            {"loop_depth", members[i].loop_depth},
+            {"calls", calls},
+            {"defs", def_names},
+        };
+    });
+
+    return json{{"module", world.name()}, {"scopes", reports}};
 }
 
 }
@@ -0,0 +1,104 @@
+#include "anyopt/generator.h"
+
+#include<cstring>
+#include<fstream>
+#include<iostream>
+
+using namespace anyopt;
+
+static void usage() {
+    std::cout << "usage: anyopt-gen [options]\n"
+                 "Generates a synthetic input module for anyopt.\n"
+                 "  -h     --help                 Displays this message\n"
+                 "         --defs <n>             Approximate number of defs (defaults to 1000)\n"
+                 "         --depth <n>            Nesting depth of the blocks in every function (defaults to 3)\n"
+                 "         --fanout <n>           Successors of every block above the maximum depth (defaults to 2)\n"
+                 "         --types <n>            Minimum size of the type table (defaults to 32)\n"
+                 "         --dup-ratio <f>        Fraction of functions that are copies of another one (defaults to 0)\n"
+                 "                                With several files, copies are the same external function as in an earlier file\n"
+                 "         --files <n>            Spreads the defs over <n> input files (defaults to 1)\n"
+                 "         --seed <n>             Seed of the random number generator (defaults to 1)\n"
+                 "         --version <n>          Schema version of the generated files, 1 or 2 (defaults to 1)\n"
+                 "         --module <name>        Module name (defaults to generated)\n"
+                 "  -o <file>                     Writes the module to <file> instead of the standard output\n"
+                 "                                With several files, <file> is a prefix and the files are named <file>.<i>.json\n"
+                 ;
+}
+
+int main (int argc, char** argv) {
+    GeneratorOptions opts;
+    std::string output;
+
+    for (int i = 1; i < argc; ++i) {
+        auto matches = [&] (const char* opt) { return !strcmp(argv[i], opt); };
+        auto value = [&] () -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "missing argument for option '" << argv[i] << "'" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (matches("-h") || matches("--help")) {
+            usage();
+            return EXIT_SUCCESS;
+        } else if (matches("--defs")) {
+            opts.defs = std::strtoull(value(), NULL, 10);
+        } else if (matches("--depth")) {
+            opts.depth = std::strtoull(value(), NULL, 10);
+        } else if (matches("--fanout")) {
+            opts.fanout = std::strtoull(value(), NULL, 10);
+        } else if (matches("--types")) {
+            opts.types = std::strtoull(value(), NULL, 10);
+        } else if (matches("--dup-ratio")) {
+            opts.dup_ratio = std::strtod(value(), NULL);
+            if (opts.dup_ratio < 0 || opts.dup_ratio > 1) {
+                std::cerr << "--dup-ratio must be between 0 and 1" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (matches("--files")) {
+            opts.files = std::strtoull(value(), NULL, 10);
+            if (opts.files == 0) {
+                std::cerr << "--files must be at least 1" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (matches("--seed")) {
+            opts.seed = std::strtoull(value(), NULL, 10);
+        } else if (matches("--version")) {
+            opts.version = std::atoi(value());
+            if (opts.version != 1 && opts.version != 2) {
+                std::cerr << "--version must be 1 or 2" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (matches("--module")) {
+            opts.module = value();
+        } else if (matches("-o")) {
+            output = value();
+        } else {
+            std::cerr << "unknown option '" << argv[i] << "'" << std::endl;
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (opts.files > 1 && output == "") {
+        std::cerr << "several files need -o" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    auto modules = generate_modules(opts);
+    if (output == "") {
+        std::cout << modules[0].dump() << std::endl;
+        return EXIT_SUCCESS;
+    }
+    for (size_t i = 0; i < modules.size(); ++i) {
+        auto name = opts.files > 1 ? output + "." + std::to_string(i) + ".json" : output;
+        std::ofstream file(name);
+        if (!file) {
+            std::cerr << "cannot open '" << name << "' for writing" << std::endl;
+            return EXIT_FAILURE;
+        }
+        file << modules[i].dump() << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
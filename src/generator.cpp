@@ -0,0 +1,490 @@
+#include "anyopt/generator.h"
+#include "anyopt/tables/deftable.h"
+
+#include<map>
+#include<random>
+#include<set>
+#include<vector>
+
+namespace anyopt {
+
+namespace {
+
+/// Values that are available in a block, by type.
+struct Values {
+    std::string mem;
+    std::vector<std::string> i32s;
+    std::vector<std::string> f32s;
+    std::vector<std::string> bools;
+};
+
+/// External functions generated so far, by name and the seed of their body.
+typedef std::vector<std::pair<std::string, uint64_t>> Functions;
+
+class Generator {
+public:
+    Generator(const GeneratorOptions& opts, size_t file = 0) : opts_(opts), rng_(opts.seed + file), file_(file) {}
+
+    /// Generates the file, copying functions from earlier files and adding its own ones to them.
+    json run (size_t defs, Functions& functions);
+
+private:
+    enum OpKind {
+        IntArith, FloatArith, Math, Literal, Compare, Choose, Convert, Reinterpret, Undefined, TupleOps, VectorOps,
+        StructOps, ArrayOps, VariantOps, StackOps, GlobalOps, HeapOps, KnownOps, RunOps, SizeOps, AsmOps, IndefArrayOps,
+        NumOpKinds
+    };
+
+    std::string type (json desc);
+    void build_types ();
+
+    std::string def (json desc);
+    std::string fresh () { return prefix_ + std::to_string(counter_++); }
+    void shared_defs ();
+
+    const std::string& pick (const std::vector<std::string>& values) { return values[std::uniform_int_distribution<size_t>(0, values.size() - 1)(body_rng_)]; }
+    bool chance (double p) { return std::bernoulli_distribution(p)(body_rng_); }
+    std::string extract (const std::string& aggregate, const std::string& index) { return def({ { "type", "extract" }, { "args", { aggregate, index } } }); }
+
+    void function (const std::string& name, uint64_t seed, bool cover);
+    void block (const std::string& name, Values values, size_t depth, const std::string& ret);
+    void emit_op (Values& values, int kind);
+
+    const GeneratorOptions& opts_;
+    std::mt19937_64 rng_;
+    std::mt19937_64 body_rng_;
+    size_t file_;
+
+    json types_ = json::array();
+    std::map<std::string, std::string> type_names_;
+    json defs_ = json::array();
+    std::string prefix_;
+    size_t counter_ = 0;
+
+    size_t block_budget_ = 0;
+    bool cover_ = false;
+
+    //Names of the types and shared defs that function bodies refer to.
+    std::string mem_, bool_, i32_, i64_, f32_, f32x4_, block_, ret_, function_, struct_, variant_, indef_, asm_;
+    std::vector<std::string> index_;
+    std::string true_, false_, zero64_, table_, filter_, branch_;
+};
+
+std::string Generator::type (json desc) {
+    auto& name = type_names_[desc.dump()];
+    if (name == "") {
+        name = "t" + std::to_string(types_.size());
+        desc["name"] = name;
+        types_.push_back(desc);
+    }
+    return name;
+}
+
+void Generator::build_types () {
+    mem_ = type({ { "type", "mem" } });
+    bool_ = type({ { "type", "prim" }, { "tag", "bool" }, { "length", 1 } });
+    i32_ = type({ { "type", "prim" }, { "tag", "qs32" }, { "length", 1 } });
+    i64_ = type({ { "type", "prim" }, { "tag", "qs64" }, { "length", 1 } });
+    f32_ = type({ { "type", "prim" }, { "tag", "qf32" }, { "length", 1 } });
+    block_ = type({ { "type", "function" }, { "args", { mem_ } } });
+    ret_ = type({ { "type", "function" }, { "args", { mem_, i32_ } } });
+    function_ = type({ { "type", "function" }, { "args", { mem_, i32_, f32_, ret_ } } });
+    struct_ = type({ { "type", "struct" }, { "struct_name", "Pair" }, { "arg_names", { "first", "second" } }, { "args", { i32_, f32_ } } });
+    variant_ = type({ { "type", "variant" }, { "variant_name", "Either" }, { "arg_names", { "left", "right" } }, { "args", { i32_, f32_ } } });
+    indef_ = type({ { "type", "indef_array" }, { "args", { i32_ } } });
+    asm_ = type({ { "type", "tuple" }, { "args", { mem_, i32_ } } });
+
+    f32x4_ = type({ { "type", "prim" }, { "tag", "qf32" }, { "length", 4 } });
+
+    //The remaining kinds are not needed by the bodies, but every kind is part of the table.
+    type({ { "type", "tuple" }, { "args", { i32_, f32_ } } });
+    type({ { "type", "def_array" }, { "args", { i32_ } }, { "length", 4 } });
+    type({ { "type", "bottom" } });
+    type({ { "type", "frame" } });
+    type({ { "type", "closure" }, { "args", { mem_, i32_, ret_ } } });
+    type({ { "type", "ptr" }, { "args", { i32_ } }, { "length", 1 } });
+    type({ { "type", "ptr" }, { "args", { f32_ } }, { "length", 1 }, { "addrspace", "global" } });
+
+    //Pad the table with distinct structural types up to the requested size.
+    std::vector<std::string> base = { bool_, i32_, i64_, f32_ };
+    for (size_t length = 8; types_.size() < opts_.types; ++length) {
+        if (length % 2 == 0) {
+            type({ { "type", "def_array" }, { "args", { base[length % base.size()] } }, { "length", length } });
+        } else {
+            json args = json::array();
+            for (size_t i = 0; i < 2 + length % 3; ++i)
+                args.push_back(base[std::uniform_int_distribution<size_t>(0, base.size() - 1)(rng_)]);
+            args.push_back(type({ { "type", "def_array" }, { "args", { i64_ } }, { "length", length } }));
+            type({ { "type", "tuple" }, { "args", args } });
+        }
+    }
+}
+
+std::string Generator::def (json desc) {
+    auto name = fresh();
+    desc["name"] = name;
+    defs_.push_back(desc);
+    return name;
+}
+
+void Generator::shared_defs () {
+    prefix_ = "g";
+    for (int i = 0; i < 4; ++i)
+        index_.push_back(def({ { "type", "const" }, { "const_type", i32_ }, { "value", i } }));
+    true_ = def({ { "type", "const" }, { "const_type", bool_ }, { "value", true } });
+    false_ = def({ { "type", "const" }, { "const_type", bool_ }, { "value", false } });
+    zero64_ = def({ { "type", "const" }, { "const_type", i64_ }, { "value", 0 } });
+
+    auto init = def({ { "type", "def_array" }, { "elem_type", i32_ }, { "args", index_ } });
+    table_ = def({ { "type", "global" }, { "init", init }, { "mutable", true } });
+    filter_ = def({ { "type", "filter" }, { "args", { false_ } } });
+    branch_ = def({ { "type", "continuation" }, { "intrinsic", "branch" } });
+
+    //A closure around a function that returns its argument.
+    auto body = fresh();
+    defs_.push_back({ { "name", body }, { "type", "continuation" }, { "fn_type", function_ },
+                      { "arg_names", { body + "_mem", body + "_x", body + "_y", body + "_ret" } },
+                      { "app", { { "target", body + "_ret" }, { "args", { body + "_mem", body + "_x" } } } } });
+    auto closure_type = type({ { "type", "closure" }, { "args", { mem_, i32_, f32_, ret_ } } });
+    def({ { "type", "closure" }, { "closure_type", closure_type }, { "args", { body, zero64_ } } });
+}
+
+void Generator::emit_op (Values& values, int kind) {
+    auto i = [&] () { return pick(values.i32s); };
+    auto f = [&] () { return pick(values.f32s); };
+
+    switch (kind) {
+        case IntArith: {
+            static const std::vector<std::string> ops = { "add", "sub", "mul", "and", "or", "xor" };
+            values.i32s.push_back(def({ { "type", "arithop" }, { "op", pick(ops) }, { "args", { i(), i() } } }));
+            break;
+        }
+        case FloatArith: {
+            static const std::vector<std::string> ops = { "add", "sub", "mul" };
+            values.f32s.push_back(def({ { "type", "arithop" }, { "op", pick(ops) }, { "args", { f(), f() } } }));
+            break;
+        }
+        case Math:
+            if (chance(0.5))
+                values.f32s.push_back(def({ { "type", "mathop" }, { "op", "sqrt" }, { "args", { f() } } }));
+            else
+                values.f32s.push_back(def({ { "type", "mathop" }, { "op", "fmin" }, { "args", { f(), f() } } }));
+            break;
+        case Literal:
+            if (chance(0.5))
+                values.i32s.push_back(def({ { "type", "const" }, { "const_type", i32_ }, { "value", std::uniform_int_distribution<int>(-100, 100)(body_rng_) } }));
+            else
+                values.f32s.push_back(def({ { "type", "const" }, { "const_type", f32_ }, { "value", std::uniform_real_distribution<double>(-1, 1)(body_rng_) } }));
+            break;
+        case Compare: {
+            static const std::vector<std::string> ops = { "eq", "ne", "lt", "le", "gt", "ge" };
+            values.bools.push_back(def({ { "type", "cmp" }, { "op", pick(ops) }, { "args", { i(), i() } } }));
+            break;
+        }
+        case Choose:
+            values.i32s.push_back(def({ { "type", "select" }, { "args", { pick(values.bools), i(), i() } } }));
+            break;
+        case Convert:
+            values.f32s.push_back(def({ { "type", "cast" }, { "target_type", f32_ }, { "source", i() } }));
+            values.i32s.push_back(def({ { "type", "cast" }, { "target_type", i32_ }, { "source", f() } }));
+            break;
+        case Reinterpret:
+            values.i32s.push_back(def({ { "type", "bitcast" }, { "target_type", i32_ }, { "source", f() } }));
+            break;
+        case Undefined:
+            values.i32s.push_back(def({ { "type", "top" }, { "const_type", i32_ } }));
+            values.i32s.push_back(def({ { "type", "bottom" }, { "const_type", i32_ } }));
+            break;
+        case TupleOps: {
+            auto tuple = def({ { "type", "tuple" }, { "args", { i(), f() } } });
+            values.i32s.push_back(extract(tuple, index_[0]));
+            auto inserted = def({ { "type", "insert" }, { "args", { tuple, index_[1], f() } } });
+            values.f32s.push_back(extract(inserted, index_[1]));
+            break;
+        }
+        case VectorOps: {
+            auto vector = def({ { "type", "vector" }, { "args", { f(), f(), f(), f() } } });
+            values.f32s.push_back(extract(vector, pick(index_)));
+            json lanes = json::array();
+            for (int lane = 0; lane < 4; ++lane)
+                lanes.push_back(std::uniform_real_distribution<double>(-1, 1)(body_rng_));
+            auto literal = def({ { "type", "const" }, { "const_type", f32x4_ }, { "value", lanes } });
+            values.f32s.push_back(extract(literal, pick(index_)));
+            values.f32s.push_back(extract(def({ { "type", pick({ "top", "bottom" }) }, { "const_type", f32x4_ } }), pick(index_)));
+            break;
+        }
+        case StructOps: {
+            auto aggregate = def({ { "type", "struct" }, { "struct_type", struct_ }, { "args", { i(), f() } } });
+            values.i32s.push_back(extract(aggregate, index_[0]));
+            break;
+        }
+        case ArrayOps: {
+            auto array = def({ { "type", "def_array" }, { "elem_type", i32_ }, { "args", { i(), i(), i(), i() } } });
+            values.i32s.push_back(extract(array, pick(index_)));
+            break;
+        }
+        case VariantOps: {
+            auto variant = def({ { "type", "variant" }, { "variant_type", variant_ }, { "value", i() }, { "index", 0 } });
+            values.i32s.push_back(def({ { "type", "variant_extract" }, { "value", variant }, { "index", 0 } }));
+            def({ { "type", "variant_index" }, { "value", variant } });
+            break;
+        }
+        case StackOps: {
+            auto frame = def({ { "type", "enter" }, { "mem", values.mem } });
+            auto slot = def({ { "type", "slot" }, { "target_type", i32_ }, { "frame", extract(frame, index_[1]) } });
+            auto stored = def({ { "type", "store" }, { "args", { extract(frame, index_[0]), slot, i() } } });
+            auto loaded = def({ { "type", "load" }, { "args", { stored, slot } } });
+            values.mem = extract(loaded, index_[0]);
+            values.i32s.push_back(extract(loaded, index_[1]));
+            break;
+        }
+        case GlobalOps: {
+            auto element = def({ { "type", "lea" }, { "args", { table_, pick(index_) } } });
+            auto loaded = def({ { "type", "load" }, { "args", { values.mem, element } } });
+            values.mem = extract(loaded, index_[0]);
+            values.i32s.push_back(extract(loaded, index_[1]));
+            if (chance(0.5))
+                values.mem = def({ { "type", "store" }, { "args", { values.mem, element, i() } } });
+            break;
+        }
+        case HeapOps: {
+            auto alloc = def({ { "type", "alloc" }, { "target_type", indef_ }, { "args", { values.mem, zero64_ } } });
+            auto element = def({ { "type", "lea" }, { "args", { extract(alloc, index_[1]), pick(index_) } } });
+            values.mem = def({ { "type", "store" }, { "args", { extract(alloc, index_[0]), element, i() } } });
+            break;
+        }
+        case KnownOps:
+            values.bools.push_back(def({ { "type", "known" }, { "def", i() } }));
+            break;
+        case RunOps:
+            values.i32s.push_back(def({ { "type", chance(0.5) ? "run" : "hlt" }, { "target", i() } }));
+            break;
+        case SizeOps:
+            def({ { "type", chance(0.5) ? "sizeof" : "alignof" }, { "target_type", struct_ } });
+            break;
+        case AsmOps: {
+            auto assembly = def({ { "type", "assembly" }, { "asm_type", asm_ }, { "inputs", { values.mem, i() } },
+                                  { "asm_template", "mov $1, $0" }, { "output_constraints", { "=r" } }, { "input_constraints", { "r" } },
+                                  { "clobbers", json::array() }, { "flags", "noflag" } });
+            values.mem = extract(assembly, index_[0]);
+            values.i32s.push_back(extract(assembly, index_[1]));
+            break;
+        }
+        case IndefArrayOps:
+            def({ { "type", "indef_array" }, { "elem_type", i32_ }, { "dim", i() } });
+            break;
+    }
+}
+
+void Generator::block (const std::string& name, Values values, size_t depth, const std::string& ret) {
+    json desc = { { "name", name }, { "type", "continuation" }, { "fn_type", block_ }, { "arg_names", { name + "_mem" } } };
+    values.mem = name + "_mem";
+
+    size_t start = defs_.size();
+    if (cover_) {
+        //The first block of the covering function goes through every kind of op once.
+        for (int kind = 0; kind < NumOpKinds; ++kind)
+            emit_op(values, kind);
+        cover_ = false;
+    }
+    while (defs_.size() - start < block_budget_)
+        emit_op(values, std::uniform_int_distribution<int>(0, NumOpKinds - 1)(body_rng_));
+
+    if (depth >= opts_.depth || opts_.fanout == 0) {
+        desc["app"] = { { "target", ret }, { "args", { values.mem, pick(values.i32s) } } };
+        defs_.push_back(desc);
+        return;
+    }
+
+    std::vector<std::string> children;
+    for (size_t i = 0; i < opts_.fanout; ++i)
+        children.push_back(fresh());
+
+    if (children.size() == 1) {
+        desc["app"] = { { "target", children[0] }, { "args", { values.mem } } };
+        defs_.push_back(desc);
+    } else {
+        //A chain of branches picks one of the children.
+        auto mem = values.mem;
+        for (size_t i = 0; i + 1 < children.size(); ++i) {
+            auto otherwise = i + 2 == children.size() ? children[i + 1] : fresh();
+            desc["app"] = { { "target", branch_ }, { "args", { mem, pick(values.bools), children[i], otherwise } } };
+            defs_.push_back(desc);
+            mem = otherwise + "_mem";
+            if (i + 2 < children.size())
+                desc = { { "name", otherwise }, { "type", "continuation" }, { "fn_type", block_ }, { "arg_names", { otherwise + "_mem" } }, { "filter", filter_ } };
+        }
+    }
+
+    for (auto& child : children)
+        block(child, values, depth + 1, ret);
+}
+
+void Generator::function (const std::string& name, uint64_t seed, bool cover) {
+    body_rng_.seed(seed);
+    prefix_ = name + "_";
+    counter_ = 0;
+    cover_ = cover;
+
+    Values values;
+    values.i32s = index_;
+    values.i32s.push_back(name + "_x");
+    values.f32s.push_back(name + "_y");
+    values.bools = { true_, false_ };
+
+    auto entry = fresh();
+    defs_.push_back({ { "name", name }, { "type", "continuation" }, { "fn_type", function_ }, { "external", name },
+                      { "arg_names", { name + "_mem", name + "_x", name + "_y", name + "_ret" } },
+                      { "app", { { "target", entry }, { "args", { name + "_mem" } } } } });
+    block(entry, values, 0, name + "_ret");
+}
+
+json Generator::run (size_t defs, Functions& earlier) {
+    build_types();
+    shared_defs();
+
+    size_t blocks = 0;
+    for (size_t level = 0, width = 1; level <= opts_.depth; ++level, width *= std::max<size_t>(opts_.fanout, 1))
+        blocks += width;
+    size_t functions = std::max<size_t>(defs / (blocks * 16), 1);
+    block_budget_ = std::max<size_t>(defs / (functions * blocks), 2) - 1;
+
+    //Names of later files carry the file number, apart from the digits after the underscore of a function's own defs.
+    auto suffix = file_ > 0 ? "_m" + std::to_string(file_) : "";
+    function("cover" + suffix, rng_(), true);
+
+    //Copies of an earlier file's functions keep their name and body, copies within the file only their body.
+    std::vector<uint64_t> seeds;
+    std::bernoulli_distribution duplicate(opts_.dup_ratio);
+    Functions added;
+    std::set<std::string> copied;
+    for (size_t i = 0; i < functions; ++i) {
+        if (!earlier.empty() && duplicate(rng_)) {
+            auto& [name, seed] = earlier[std::uniform_int_distribution<size_t>(0, earlier.size() - 1)(rng_)];
+            if (copied.emplace(name).second) {
+                function(name, seed, false);
+                continue;
+            }
+        }
+        if (earlier.empty() && !seeds.empty() && duplicate(rng_))
+            seeds.push_back(seeds[std::uniform_int_distribution<size_t>(0, seeds.size() - 1)(rng_)]);
+        else
+            seeds.push_back(rng_());
+        added.emplace_back("f" + std::to_string(i) + suffix, seeds.back());
+        function(added.back().first, seeds.back(), false);
+    }
+    earlier.insert(earlier.end(), added.begin(), added.end());
+
+    return { { "module", opts_.module }, { "type_table", types_ }, { "defs", defs_ } };
+}
+
+}
+
+/// The fields of a def description that name a type, and the ones that name other defs, as IRBuilder reads them.
+static const std::set<std::string> TypeFields {
+    "asm_type", "closure_type", "const_type", "elem_type", "fn_type", "struct_type", "target_type", "variant_type"
+};
+static const std::set<std::string> OperandFields {
+    "args", "def", "dim", "filter", "frame", "init", "inputs", "mem", "source", "target", "value"
+};
+
+/// Rewrites a version 1 module into the version 2 schema: types and defs refer to each other by position, params by
+/// [position of their continuation, index], and the def kinds in DefLayoutV2Enum become arrays of their fields.
+/// The def names are kept in "names".
+json to_version2 (const json& module) {
+    static const std::map<std::string, std::vector<std::string>> Layouts {
+#define LAYOUT(NAME, ...) {NAME, {__VA_ARGS__}},
+        DefLayoutV2Enum(LAYOUT)
+#undef LAYOUT
+    };
+
+    std::map<std::string, size_t> type_positions;
+    auto& types = module["type_table"];
+    for (size_t i = 0; i < types.size(); ++i)
+        type_positions[types[i]["name"]] = i;
+    json type_table = json::array();
+    for (auto type : types) {
+        type.erase("name");
+        if (type.contains("args")) {
+            for (auto& arg : type["args"])
+                arg = type_positions.at(arg);
+        }
+        type_table.push_back(std::move(type));
+    }
+
+    std::map<std::string, json> refs;
+    auto& defs = module["defs"];
+    for (size_t i = 0; i < defs.size(); ++i) {
+        refs[defs[i]["name"]] = i;
+        if (defs[i].contains("arg_names")) {
+            for (size_t j = 0; j < defs[i]["arg_names"].size(); ++j)
+                refs[defs[i]["arg_names"][j]] = { i, j };
+        }
+    }
+    auto ref = [&] (const json& value) {
+        if (!value.is_array())
+            return refs.at(value);
+        json list = json::array();
+        for (auto& name : value)
+            list.push_back(refs.at(name));
+        return list;
+    };
+
+    json def_list = json::array();
+    json names = json::object();
+    for (size_t i = 0; i < defs.size(); ++i) {
+        auto& desc = defs[i];
+        names[std::to_string(i)] = desc["name"];
+
+        json converted = json::object();
+        for (auto& [field, value] : desc.items()) {
+            if (field == "name" || field == "arg_names")
+                continue;
+            if (TypeFields.count(field))
+                converted[field] = type_positions.at(value);
+            else if (field == "app")
+                converted[field] = { { "target", ref(value["target"]) }, { "args", ref(value["args"]) } };
+            //Constants carry their literal in "value".
+            else if (OperandFields.count(field) && !(field == "value" && desc["type"] == "const"))
+                converted[field] = ref(value);
+            else
+                converted[field] = value;
+        }
+
+        auto layout = Layouts.find(desc["type"]);
+        if (layout != Layouts.end()) {
+            json positional = json::array({ desc["type"] });
+            for (auto& field : layout->second)
+                positional.push_back(converted[field]);
+            converted = std::move(positional);
+        }
+        def_list.push_back(std::move(converted));
+    }
+
+    json result = module;
+    result["version"] = 2;
+    result["type_table"] = std::move(type_table);
+    result["defs"] = std::move(def_list);
+    result["names"] = std::move(names);
+    return result;
+}
+
+json generate_module (const GeneratorOptions& opts) {
+    Generator generator(opts);
+    Functions functions;
+    auto module = generator.run(opts.defs, functions);
+    return opts.version == 2 ? to_version2(module) : module;
+}
+
+std::vector<json> generate_modules (const GeneratorOptions& opts) {
+    std::vector<json> files;
+    Functions functions;
+    for (size_t file = 0; file < std::max<size_t>(opts.files, 1); ++file) {
+        Generator generator(opts, file);
+        auto module = generator.run(opts.defs / std::max<size_t>(opts.files, 1), functions);
+        files.push_back(opts.version == 2 ? to_version2(module) : module);
+    }
+    return files;
+}
+
+}
@@ -0,0 +1,191 @@
+#include "anyopt/heap_to_stack.h"
+
+#include<thorin/analyses/scope.h>
+
+#include<algorithm>
+#include<iostream>
+#include<optional>
+#include<unordered_set>
+#include<vector>
+
+namespace anyopt {
+
+static size_t align_up (size_t offset, size_t align) {
+    return (offset + align - 1) / align * align;
+}
+
+/// Size and alignment of a type as laid out in memory. Returns false for types without a fixed size.
+static bool layout (const thorin::Type* type, size_t& size, size_t& align) {
+    if (auto prim = type->isa<thorin::PrimType>()) {
+        switch (prim->primtype_tag()) {
+#define THORIN_I_TYPE(T, M) case thorin::PrimType_##T: align = sizeof(thorin::M); break;
+#define THORIN_BOOL_TYPE(T, M) case thorin::PrimType_##T: align = sizeof(M); break;
+#define THORIN_F_TYPE(T, M) case thorin::PrimType_##T: align = sizeof(thorin::M); break;
+#include <thorin/tables/primtypetable.h>
+        default:
+            return false;
+        }
+        size = align * prim->length();
+        return true;
+    }
+    if (auto ptr = type->isa<thorin::PtrType>()) {
+        align = sizeof(void*);
+        size = align * ptr->length();
+        return true;
+    }
+    if (auto array = type->isa<thorin::DefiniteArrayType>()) {
+        if (!layout(array->elem_type(), size, align))
+            return false;
+        size *= array->dim();
+        return true;
+    }
+    if (type->isa<thorin::StructType>() || type->isa<thorin::TupleType>()) {
+        size_t offset = 0;
+        align = 1;
+        for (auto op : type->ops()) {
+            size_t op_size, op_align;
+            if (!layout(op, op_size, op_align))
+                return false;
+            offset = align_up(offset, op_align) + op_size;
+            align = std::max(align, op_align);
+        }
+        size = align_up(offset, align);
+        return true;
+    }
+    return false;
+}
+
+/// Continuations of scope that only run while its function is active: the entry and the basic blocks that are reached from
+/// these by jumps, branches or as the return continuation of a call. Everything else in the scope is a lambda or closure
+/// that may be passed out of the function and run after it has returned.
+static std::unordered_set<thorin::Continuation*> blocks (const thorin::Scope& scope) {
+    std::unordered_set<thorin::Continuation*> blocks;
+    for (auto def : scope.defs()) {
+        if (auto continuation = def->isa_nom<thorin::Continuation>())
+            if (continuation == scope.entry() || continuation->is_basicblock())
+                blocks.emplace(continuation);
+    }
+
+    //Drops blocks that are used anywhere but as a jump target from another block, until nothing changes.
+    auto jumped_to = [&] (thorin::Continuation* continuation) {
+        for (auto& use : continuation->uses()) {
+            auto app = use->isa<thorin::App>();
+            if (!app)
+                return false;
+            bool from_block = false;
+            for (auto& app_use : app->uses()) {
+                auto caller = app_use->isa_nom<thorin::Continuation>();
+                from_block |= caller && blocks.count(caller) && caller->body() == app;
+            }
+            if (!from_block)
+                return false;
+
+            auto callee = app->callee()->isa_nom<thorin::Continuation>();
+            bool branch = callee && (callee->intrinsic() == thorin::Intrinsic::Branch || callee->intrinsic() == thorin::Intrinsic::Match);
+            for (size_t i = 0; i < app->num_args(); ++i) {
+                bool returns_here = callee && callee->is_returning() && i + 1 == app->num_args();
+                if (app->arg(i) == continuation && !branch && !returns_here)
+                    return false;
+            }
+        }
+        return true;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = blocks.begin(); it != blocks.end();) {
+            if (*it != scope.entry() && !jumped_to(*it)) {
+                it = blocks.erase(it);
+                changed = true;
+            } else {
+                ++it;
+            }
+        }
+    }
+    return blocks;
+}
+
+/// Defs of scope that the body of a continuation other than a block depends on, these may be evaluated after the function returned.
+static std::unordered_set<const thorin::Def*> outside_blocks (const thorin::Scope& scope) {
+    auto inside = blocks(scope);
+    std::unordered_set<const thorin::Def*> outside;
+    std::vector<const thorin::Def*> stack;
+    for (auto def : scope.defs()) {
+        auto continuation = def->isa_nom<thorin::Continuation>();
+        if (continuation && !inside.count(continuation) && continuation->has_body())
+            stack.push_back(continuation->body());
+    }
+    while (!stack.empty()) {
+        auto def = stack.back();
+        stack.pop_back();
+        if (!scope.contains(def) || def->isa_nom<thorin::Continuation>() || !outside.insert(def).second)
+            continue;
+        for (auto op : def->ops())
+            stack.push_back(op);
+    }
+    return outside;
+}
+
+/// Whether the address ptr only ever reaches the address operand of loads and stores, directly or through leas, all within the blocks of scope.
+static bool stays_local (const thorin::Scope& scope, const std::unordered_set<const thorin::Def*>& outside, const thorin::Def* ptr) {
+    for (auto& use : ptr->uses()) {
+        if (!scope.contains(use.def()) || outside.count(use.def()))
+            return false;
+        if ((use->isa<thorin::Load>() || use->isa<thorin::Store>()) && use.index() == 1)
+            continue;
+        if (auto lea = use->isa<thorin::LEA>(); lea && use.index() == 0 && stays_local(scope, outside, lea))
+            continue;
+        return false;
+    }
+    return true;
+}
+
+bool heap_to_stack(thorin::Thorin& thorin, size_t limit) {
+    auto& world = thorin.world();
+
+    std::vector<std::pair<const thorin::Alloc*, size_t>> promotions;
+    size_t allocs = 0, too_large = 0;
+    std::unordered_set<const thorin::Def*> seen;
+    thorin::Scope::for_each(world, [&] (thorin::Scope& scope) {
+        std::optional<std::unordered_set<const thorin::Def*>> outside;
+        for (auto def : scope.defs()) {
+            auto alloc = def->isa<thorin::Alloc>();
+            if (!alloc || !seen.insert(alloc).second)
+                continue;
+            allocs++;
+
+            size_t size, align;
+            if (!layout(alloc->alloced_type(), size, align))
+                continue;
+            if (size > limit) {
+                too_large++;
+                continue;
+            }
+
+            //The alloc's memory and address are taken apart right away, anything else lets the address out.
+            bool local = true;
+            for (auto& use : alloc->uses())
+                local &= use->isa<thorin::Extract>() && scope.contains(use.def());
+            if (!local)
+                continue;
+            //An alloc in a closure gets its own frame each time it runs, so only allocs of the function's blocks are moved.
+            if (!outside)
+                outside = outside_blocks(scope);
+            if (!outside->count(alloc) && stays_local(scope, *outside, alloc->out_ptr()))
+                promotions.emplace_back(alloc, size);
+        }
+    });
+
+    for (auto& [alloc, size] : promotions) {
+        auto enter = world.enter(alloc->mem())->as<thorin::Enter>();
+        auto slot = world.slot(alloc->alloced_type(), enter->out_frame());
+        alloc->out_ptr()->replace_uses(slot);
+        alloc->out_mem()->replace_uses(enter->out_mem());
+        std::cerr << "  moved " << alloc->unique_name() << " (" << size << " bytes) to the stack" << std::endl;
+    }
+
+    std::cerr << "  moved " << promotions.size() << " of " << allocs << " allocs to the stack, " << too_large
+              << " were larger than " << limit << " bytes" << std::endl;
+    return !promotions.empty();
+}
+
+}
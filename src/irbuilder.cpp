@@ -1,5 +1,11 @@
 #include "anyopt/irbuilder.h"
 
+#include<algorithm>
+#include<cstring>
+#include<deque>
+#include<functional>
+#include<unordered_map>
+
 namespace anyopt {
 
 IRBuilder::DefType IRBuilder::resolvedef (std::string def_type) {
@@ -18,61 +24,170 @@ IRBuilder::DefType IRBuilder::resolvedef (std::string def_type) {
     }
 }
 
-thorin::Array<const thorin::Def*> IRBuilder::get_arglist (json arg_list) {
+thorin::Array<const thorin::Def*> IRBuilder::get_arglist (const json& arg_list) {
     //Get all argument types based on their alias.
     thorin::Array<const thorin::Def*> args(arg_list.size());
     for (int argnum = 0; argnum < arg_list.size(); ++argnum) {
-        json arg_desc = arg_list[argnum];
+        const json& arg_desc = arg_list[argnum];
         args[argnum] = get_def(arg_desc);
     }
 
     return args;
 }
 
+/// Field names of the positional version 2 layout of kind, or nullptr if kind has none.
+static const std::vector<const char*>* positional_layout (const std::string& kind) {
+    static const std::unordered_map<std::string, std::vector<const char*>> Layouts {
+#define LAYOUT(NAME, ...) {NAME, {__VA_ARGS__}},
+        DefLayoutV2Enum(LAYOUT)
+#undef LAYOUT
+    };
+
+    auto layout = Layouts.find(kind);
+    return layout != Layouts.end() ? &layout->second : nullptr;
+}
+
+DefDesc::DefDesc(const json& desc, size_t position) : desc_(desc), position_(position), indexed_(true) {
+    if (desc.is_array()) {
+        layout_ = positional_layout(desc[0]);
+        if (!layout_) {
+            std::cerr << "No positional layout for def type: " << desc[0] << std::endl;
+            abort();
+        }
+        if (desc.size() != layout_->size() + 1) {
+            std::cerr << "Def #" << position << " has " << desc.size() - 1 << " fields, its layout has " << layout_->size() << std::endl;
+            abort();
+        }
+    }
+}
+
+const json& DefDesc::operator[] (const char* field) const {
+    if (!layout_)
+        return desc_[field];
+    for (size_t i = 0; i < layout_->size(); ++i) {
+        if (!strcmp((*layout_)[i], field))
+            return desc_[i + 1];
+    }
+    std::cerr << "Def #" << position_ << " has no field " << field << std::endl;
+    abort();
+}
+
+bool DefDesc::contains (const char* field) const {
+    if (!layout_)
+        return desc_.contains(field);
+    for (auto layout_field : *layout_) {
+        if (!strcmp(layout_field, field))
+            return true;
+    }
+    return false;
+}
+
+const thorin::Def* IRBuilder::find_def (size_t position) {
+    return position < indexed_defs.size() ? indexed_defs[position] : nullptr;
+}
+
+const thorin::Def* IRBuilder::find_def (const std::string& name) {
+    auto it = known_defs.find(name);
+    return it != known_defs.end() ? it->second : nullptr;
+}
+
+const thorin::Def* IRBuilder::find_def (const DefDesc& desc) {
+    return desc.positional() ? find_def(desc.position()) : find_def(desc.name().get_ref<const std::string&>());
+}
+
+const thorin::Def*& IRBuilder::def_slot (const DefDesc& desc) {
+    if (desc.positional()) {
+        if (desc.position() >= indexed_defs.size())
+            indexed_defs.resize(desc.position() + 1, nullptr);
+        return indexed_defs[desc.position()];
+    }
+    return known_defs[desc.name()];
+}
+
+const thorin::Def* IRBuilder::get_def (const json& def_ref) {
+    if (def_ref.is_string())
+        return get_def(def_ref.get<std::string>());
+    if (def_ref.is_array())
+        return get_def(def_ref[0])->as_nom<thorin::Continuation>()->param(def_ref[1].get<size_t>());
+    return get_def(def_ref.get<size_t>());
+}
+
+const thorin::Def* IRBuilder::get_def (size_t position) {
+    auto def = find_def(position);
+    if (!def && pending_defs_ && position < pending_defs_->size()) {
+        if (build_pending({ position }))
+            def = find_def(position);
+        else
+            std::cerr << "Cyclic definition: #" << position << std::endl;
+    }
+    if (!def)
+        std::cerr << "Unknown argument name: #" << position << std::endl;
+    assert(def && "Unknown argument name!");
+    return def;
+}
+
 const thorin::Def* IRBuilder::get_def (std::string type_name) {
     auto it = known_defs.find(type_name);
+    if (it == known_defs.end() && pending_defs_) {
+        auto positions = def_index.find(type_name);
+        if (positions != def_index.end()) {
+            if (!build_pending(positions->second))
+                std::cerr << "Cyclic definition: " << type_name << std::endl;
+            else if (auto def = find_def(type_name))
+                return def;
+        }
+    }
     if(it == known_defs.end())
        std::cerr << "Unknown argument name: " << type_name << std::endl;
     assert(it != known_defs.end() && "Unknown argument name!");
     return it->second;
 }
 
-const thorin::Def * IRBuilder::build_Constant (json desc) {
-    auto const_type = typetable_.get_type(desc["const_type"]);
-    auto primtype = const_type->as<thorin::PrimType>();
-    assert(primtype->length() == 1);
-
-    thorin::Box value;
-    switch (primtype->tag()) {
-#define THORIN_I_TYPE(T, M) case thorin::PrimType_##T: { value = thorin::Box(desc["value"].get<thorin::M>()); break; }
-#define THORIN_BOOL_TYPE(T, M) case thorin::PrimType_##T: { value = thorin::Box(desc["value"].get<M>()); break; }
-#define THORIN_F_TYPE(T, M) case thorin::PrimType_##T: { value = thorin::Box((thorin::M)desc["value"].get<double>()); break; }
+static thorin::Box box_value (thorin::PrimTypeTag tag, const json& value) {
+    switch (tag) {
+#define THORIN_I_TYPE(T, M) case thorin::PrimType_##T: return thorin::Box(value.get<thorin::M>());
+#define THORIN_BOOL_TYPE(T, M) case thorin::PrimType_##T: return thorin::Box(value.get<M>());
+#define THORIN_F_TYPE(T, M) case thorin::PrimType_##T: return thorin::Box((thorin::M)value.get<double>());
 #include <thorin/tables/primtypetable.h>
     default:
         std::cerr << "not implemented\n";
         abort();
     }
-    const thorin::Def* literal = world().literal(primtype->primtype_tag(), value, {});
-    return literal;
 }
 
-const thorin::Def * IRBuilder::build_Top (json desc) {
+const thorin::Def * IRBuilder::build_Constant (const DefDesc& desc) {
+    auto const_type = typetable_.get_type(desc["const_type"]);
+    auto primtype = const_type->as<thorin::PrimType>();
+    auto tag = primtype->primtype_tag();
+
+    if (primtype->length() == 1)
+        return world().literal(tag, box_value(tag, desc["value"]), {});
+
+    //Vector literals list one value per lane, a single value is splatted across all lanes.
+    auto& value = desc["value"];
+    if (value.is_array() && value.size() != primtype->length()) {
+        std::cerr << "Vector literal has " << value.size() << " values for " << primtype->length() << " lanes" << std::endl;
+        abort();
+    }
+    thorin::Array<const thorin::Def*> lanes(primtype->length());
+    for (size_t i = 0; i < lanes.size(); ++i)
+        lanes[i] = world().literal(tag, box_value(tag, value.is_array() ? value[i] : value), {});
+    return world().vector(lanes);
+}
+
+const thorin::Def * IRBuilder::build_Top (const DefDesc& desc) {
     auto const_type = typetable_.get_type(desc["const_type"]);
-    if (auto vector_type = const_type->isa<thorin::VectorType>())
-        assert(vector_type->length() == 1);
 
     return world().top(const_type);
 }
 
-const thorin::Def * IRBuilder::build_Bottom (json desc) {
+const thorin::Def * IRBuilder::build_Bottom (const DefDesc& desc) {
     auto const_type = typetable_.get_type(desc["const_type"]);
-    if (auto vector_type = const_type->isa<thorin::VectorType>())
-        assert(vector_type->length() == 1);
 
     return world().bottom(const_type);
 }
 
-const thorin::Def * IRBuilder::build_Alloc (json desc) {
+const thorin::Def * IRBuilder::build_Alloc (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
     auto target_type = typetable_.get_type(desc["target_type"]);
 
@@ -81,25 +196,25 @@ const thorin::Def * IRBuilder::build_Alloc (json desc) {
     return world().alloc(target_type, args[0], args[1]);
 }
 
-const thorin::Def * IRBuilder::build_Known (json desc) {
+const thorin::Def * IRBuilder::build_Known (const DefDesc& desc) {
     auto def = get_def(desc["def"]);
 
     return world().known(def);
 }
 
-const thorin::Def * IRBuilder::build_Sizeof (json desc) {
+const thorin::Def * IRBuilder::build_Sizeof (const DefDesc& desc) {
     auto target_type = typetable_.get_type(desc["target_type"]);
 
     return world().size_of(target_type);
 }
 
-const thorin::Def * IRBuilder::build_Alignof (json desc) {
+const thorin::Def * IRBuilder::build_Alignof (const DefDesc& desc) {
     auto target_type = typetable_.get_type(desc["target_type"]);
 
     return world().align_of(target_type);
 }
 
-const thorin::Def * IRBuilder::build_Select (json desc) {
+const thorin::Def * IRBuilder::build_Select (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     assert(args.size() == 3);
@@ -107,12 +222,11 @@ const thorin::Def * IRBuilder::build_Select (json desc) {
     return world().select(args[0], args[1], args[2]);
 }
 
-const thorin::Def * IRBuilder::build_Continuation (json desc) {
+thorin::Continuation* IRBuilder::declare_continuation (const DefDesc& desc) {
     thorin::Continuation* continuation = nullptr;
 
-    auto forward_decl = known_defs.find(desc["name"]);
-    if (forward_decl != known_defs.end()) {
-        continuation = forward_decl->second->as_nom<thorin::Continuation>();
+    if (auto forward_decl = find_def(desc)) {
+        continuation = forward_decl->as_nom<thorin::Continuation>();
     } else {
         if (desc.contains("internal")) {
             continuation = extern_globals_.lookup(desc["internal"]).value_or(nullptr)->as<thorin::Continuation>();
@@ -138,13 +252,9 @@ const thorin::Def * IRBuilder::build_Continuation (json desc) {
             auto fn_type = typetable_.get_type(desc["fn_type"])->as<thorin::FnType>();
             continuation = world().continuation(fn_type);
         }
+        def_slot(desc) = continuation;
     }
 
-    if (desc.contains("filter")) {
-        auto filter = get_def(desc["filter"])->as<thorin::Filter>();
-        continuation->set_filter(filter);
-    }
-    
     if (desc.contains("arg_names")) {
         for (size_t i = 0; i < desc["arg_names"].size(); ++i) {
             auto arg = desc["arg_names"][i];
@@ -152,6 +262,15 @@ const thorin::Def * IRBuilder::build_Continuation (json desc) {
         }
     }
 
+    return continuation;
+}
+
+void IRBuilder::define_continuation (thorin::Continuation* continuation, const DefDesc& desc) {
+    if (desc.contains("filter")) {
+        auto filter = get_def(desc["filter"])->as<thorin::Filter>();
+        continuation->set_filter(filter);
+    }
+
     if (desc.contains("external")) {
         continuation->set_name(desc["external"]);
         world().make_external(continuation);
@@ -177,7 +296,11 @@ const thorin::Def * IRBuilder::build_Continuation (json desc) {
             continuation->set_intrinsic();
         }
     }
+}
 
+const thorin::Def * IRBuilder::build_Continuation (const DefDesc& desc) {
+    auto continuation = declare_continuation(desc);
+    define_continuation(continuation, desc);
     return continuation;
 }
 
@@ -194,7 +317,7 @@ thorin::ArithOpTag IRBuilder::resolve_arithop_tag (std::string arithop_tag) {
         abort();
 }
 
-const thorin::Def * IRBuilder::build_ArithOp (json desc) {
+const thorin::Def * IRBuilder::build_ArithOp (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
     auto tag = resolve_arithop_tag(desc["op"]);
 
@@ -216,14 +339,14 @@ thorin::MathOpTag IRBuilder::resolve_mathop_tag (std::string mathop_tag) {
         abort();
 }
 
-const thorin::Def * IRBuilder::build_MathOp (json desc) {
+const thorin::Def * IRBuilder::build_MathOp (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
     auto tag = resolve_mathop_tag(desc["op"]);
 
     return world().mathop(tag, args);
 }
 
-const thorin::Def * IRBuilder::build_LEA (json desc) {
+const thorin::Def * IRBuilder::build_LEA (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     assert(args.size() == 2);
@@ -231,7 +354,7 @@ const thorin::Def * IRBuilder::build_LEA (json desc) {
     return world().lea(args[0], args[1], {});
 }
 
-const thorin::Def * IRBuilder::build_Load (json desc) {
+const thorin::Def * IRBuilder::build_Load (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     assert(args.size() == 2);
@@ -239,7 +362,7 @@ const thorin::Def * IRBuilder::build_Load (json desc) {
     return world().load(args[0], args[1]);
 }
 
-const thorin::Def * IRBuilder::build_Extract (json desc) {
+const thorin::Def * IRBuilder::build_Extract (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     assert(args.size() == 2);
@@ -247,7 +370,7 @@ const thorin::Def * IRBuilder::build_Extract (json desc) {
     return world().extract(args[0], args[1]);
 }
 
-const thorin::Def * IRBuilder::build_Insert (json desc) {
+const thorin::Def * IRBuilder::build_Insert (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     assert(args.size() == 3);
@@ -255,7 +378,7 @@ const thorin::Def * IRBuilder::build_Insert (json desc) {
     return world().insert(args[0], args[1], args[2]);
 }
 
-const thorin::Def * IRBuilder::build_Cast (json desc) {
+const thorin::Def * IRBuilder::build_Cast (const DefDesc& desc) {
     auto target_type = typetable_.get_type(desc["target_type"]);
     auto source = get_def(desc["source"]);
 
@@ -275,7 +398,7 @@ thorin::CmpTag IRBuilder::resolve_cmp_tag (std::string cmp_tag) {
         abort();
 }
 
-const thorin::Def * IRBuilder::build_Cmp (json desc) {
+const thorin::Def * IRBuilder::build_Cmp (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
     auto tag = resolve_cmp_tag(desc["op"]);
 
@@ -284,19 +407,19 @@ const thorin::Def * IRBuilder::build_Cmp (json desc) {
     return world().cmp(tag, args[0], args[1]);
 }
 
-const thorin::Def * IRBuilder::build_Run (json desc) {
+const thorin::Def * IRBuilder::build_Run (const DefDesc& desc) {
     auto target = get_def(desc["target"]);
 
     return world().run(target);
 }
 
-const thorin::Def * IRBuilder::build_Hlt (json desc) {
+const thorin::Def * IRBuilder::build_Hlt (const DefDesc& desc) {
     auto target = get_def(desc["target"]);
 
     return world().hlt(target);
 }
 
-const thorin::Def * IRBuilder::build_Store (json desc) {
+const thorin::Def * IRBuilder::build_Store (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     assert(args.size() == 3);
@@ -304,41 +427,41 @@ const thorin::Def * IRBuilder::build_Store (json desc) {
     return world().store(args[0], args[1], args[2]);
 }
 
-const thorin::Def * IRBuilder::build_Enter (json desc) {
+const thorin::Def * IRBuilder::build_Enter (const DefDesc& desc) {
     auto mem = get_def(desc["mem"]);
 
     return world().enter(mem);
 }
 
-const thorin::Def * IRBuilder::build_Slot (json desc) {
+const thorin::Def * IRBuilder::build_Slot (const DefDesc& desc) {
     auto target_type = typetable_.get_type(desc["target_type"]);
     auto frame = get_def(desc["frame"]);
 
     return world().slot(target_type, frame);
 }
 
-const thorin::Def * IRBuilder::build_Bitcast (json desc) {
+const thorin::Def * IRBuilder::build_Bitcast (const DefDesc& desc) {
     auto target_type = typetable_.get_type(desc["target_type"]);
     auto source = get_def(desc["source"]);
 
     return world().bitcast(target_type, source);
 }
 
-const thorin::Def * IRBuilder::build_IndefiniteArray (json desc) {
+const thorin::Def * IRBuilder::build_IndefiniteArray (const DefDesc& desc) {
     auto elem_type = typetable_.get_type(desc["elem_type"]);
     auto dim = get_def(desc["dim"]);
 
     return world().indefinite_array(elem_type, dim);
 }
 
-const thorin::Def * IRBuilder::build_DefiniteArray (json desc) {
+const thorin::Def * IRBuilder::build_DefiniteArray (const DefDesc& desc) {
     auto elem_type = typetable_.get_type(desc["elem_type"]);
     auto args = get_arglist(desc["args"]);
 
     return world().definite_array(elem_type, args);
 }
 
-const thorin::Def * IRBuilder::build_Global (json desc) {
+const thorin::Def * IRBuilder::build_Global (const DefDesc& desc) {
     bool is_mutable = desc["mutable"];
     auto init = get_def(desc["init"]);
 
@@ -364,7 +487,7 @@ const thorin::Def * IRBuilder::build_Global (json desc) {
     return def;
 }
 
-const thorin::Def * IRBuilder::build_Closure (json desc) {
+const thorin::Def * IRBuilder::build_Closure (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
     auto closure_type = typetable_.get_type(desc["closure_type"])->as<thorin::ClosureType>();
 
@@ -373,32 +496,32 @@ const thorin::Def * IRBuilder::build_Closure (json desc) {
     return world().closure(closure_type, args[0], args[1]);
 }
 
-const thorin::Def * IRBuilder::build_Struct (json desc) {
+const thorin::Def * IRBuilder::build_Struct (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
     auto struct_type = typetable_.get_type(desc["struct_type"])->as<thorin::StructType>();
 
     return world().struct_agg(struct_type, args);
 }
 
-const thorin::Def * IRBuilder::build_Tuple (json desc) {
+const thorin::Def * IRBuilder::build_Tuple (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     return world().tuple(args);
 }
 
-const thorin::Def * IRBuilder::build_Vector (json desc) {
+const thorin::Def * IRBuilder::build_Vector (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     return world().vector(args);
 }
 
-const thorin::Def * IRBuilder::build_Filter (json desc) {
+const thorin::Def * IRBuilder::build_Filter (const DefDesc& desc) {
     auto args = get_arglist(desc["args"]);
 
     return world().filter(args);
 }
 
-const thorin::Def * IRBuilder::build_Variant (json desc) {
+const thorin::Def * IRBuilder::build_Variant (const DefDesc& desc) {
     auto variant_type = typetable_.get_type(desc["variant_type"])->as<thorin::VariantType>();
     auto value = get_def(desc["value"]);
     size_t index = desc["index"];
@@ -406,7 +529,7 @@ const thorin::Def * IRBuilder::build_Variant (json desc) {
     return world().variant(variant_type, value, index);
 }
 
-const thorin::Def * IRBuilder::build_Assembly (json desc) {
+const thorin::Def * IRBuilder::build_Assembly (const DefDesc& desc) {
     auto asm_type = typetable_.get_type(desc["asm_type"]);
     auto inputs = get_arglist(desc["inputs"]);
     std::string asm_template = desc["asm_template"];
@@ -443,31 +566,363 @@ const thorin::Def * IRBuilder::build_Assembly (json desc) {
     return world().assembly(asm_type, inputs, asm_template, out_constraints, in_constraints, clobbers, flags);
 }
 
-const thorin::Def * IRBuilder::build_VariantExtract (json desc) {
+const thorin::Def * IRBuilder::build_VariantExtract (const DefDesc& desc) {
     auto value = get_def(desc["value"]);
     size_t index = desc["index"];
 
     return world().variant_extract(value, index);
 }
 
-const thorin::Def * IRBuilder::build_VariantIndex (json desc) {
+const thorin::Def * IRBuilder::build_VariantIndex (const DefDesc& desc) {
     auto value = get_def(desc["value"]);
 
     return world().variant_index(value);
 }
 
-const thorin::Def * IRBuilder::reconstruct_def(json desc) {
+const thorin::Def * IRBuilder::reconstruct_def(const DefDesc& desc) {
     const thorin::Def* return_def = nullptr;
-    switch (resolvedef(desc["type"])) {
+    switch (resolvedef(desc.kind())) {
 #define CASE(NAME, CLASS) case DefType::CLASS: { return_def = build_##CLASS(desc); break; }
     DefTypeEnum(CASE)
 #undef CASE
     default:
         std::cerr << "Def is invalid" << std::endl;
-        std::cerr << desc["name"] << std::endl;
+        if (desc.positional())
+            std::cerr << "#" << desc.position() << std::endl;
+        else
+            std::cerr << desc.name() << std::endl;
     }
     assert(return_def);
-    return known_defs[desc["name"]] = return_def;
+    return def_slot(desc) = return_def;
+}
+
+static size_t hash_combine (size_t seed, size_t value) {
+    return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+bool IRBuilder::is_operand_field (DefType kind, std::string_view field) {
+    static const std::set<std::string, std::less<>> OperandFields {
+        "app", "args", "def", "dim", "filter", "frame", "init", "inputs", "mem", "source", "target", "value"
+    };
+
+    //Constants carry their literal in "value", variants their payload.
+    if (field == "value" && kind == DefType::Constant)
+        return false;
+    return OperandFields.count(field);
+}
+
+std::vector<const json*> IRBuilder::operand_refs (const DefDesc& desc) {
+    std::vector<const json*> refs;
+    auto kind = resolvedef(desc.kind());
+
+    desc.for_each_field([&] (std::string_view field, const json& value) {
+        if (!is_operand_field(kind, field))
+            return;
+        if (field == "app") {
+            refs.push_back(&value["target"]);
+            for (auto& arg : value["args"])
+                refs.push_back(&arg);
+        } else if (value.is_array()) {
+            for (auto& arg : value)
+                refs.push_back(&arg);
+        } else {
+            refs.push_back(&value);
+        }
+    });
+
+    return refs;
+}
+
+std::vector<std::string> IRBuilder::operand_names (const json& desc) {
+    std::vector<std::string> names;
+    for (auto ref : operand_refs(desc))
+        names.push_back(*ref);
+    return names;
+}
+
+/// Content hash of the def called name, including everything it references.
+/// References to a continuation that is currently being hashed are encoded by their distance on the hash stack (de Bruijn style),
+/// so the hash does not depend on the per file def names. low receives the lowest stack depth the hash depends on.
+size_t IRBuilder::hash_def (json& defs, const std::string& name, size_t& low) {
+    static const std::set<std::string> TypeFields {
+        "asm_type", "closure_type", "const_type", "elem_type", "fn_type", "struct_type", "target_type", "variant_type"
+    };
+
+    low = SIZE_MAX;
+    if (auto closed = closed_hashes.find(name); closed != closed_hashes.end())
+        return closed->second;
+    if (auto open = open_hashes.find(name); open != open_hashes.end()) {
+        low = open->second.second;
+        return open->second.first;
+    }
+    for (size_t depth = 0; depth < hash_stack.size(); ++depth) {
+        if (hash_stack[depth] == name) {
+            low = depth;
+            return hash_combine(0xbac4, hash_stack.size() - depth);
+        }
+    }
+
+    if (auto param = param_index.find(name); param != param_index.end()) {
+        auto& [owner, index] = param->second;
+        auto owner_hash = hash_def(defs, owner, low);
+        return hash_combine(hash_combine(0x9a7a, owner_hash), index);
+    }
+
+    auto positions = def_index.find(name);
+    if (positions == def_index.end())
+        return std::hash<std::string>()(name);
+
+    auto& desc = defs[positions->second.back()];
+    auto kind = resolvedef(desc["type"]);
+
+    //Other top level definitions are linked by name, their bodies are hashed on their own.
+    if (!hash_stack.empty() && kind == DefType::Continuation) {
+        if (desc.contains("external"))
+            return hash_combine(0xe77e, std::hash<std::string>()(desc["external"].get<std::string>()));
+        if (desc.contains("internal"))
+            return hash_combine(0x1e7e, std::hash<std::string>()(desc["internal"].get<std::string>()));
+    }
+
+    size_t hash = std::hash<std::string>()(desc["type"].get<std::string>());
+    for (auto& item : desc.items()) {
+        auto& field = item.key();
+        if (field == "name" || field == "arg_names" || field == "type" || is_operand_field(kind, field))
+            continue;
+        hash = hash_combine(hash, std::hash<std::string>()(field));
+        if (TypeFields.count(field))
+            hash = hash_combine(hash, std::hash<const thorin::Type*>()(typetable_.get_type(item.value())));
+        else
+            hash = hash_combine(hash, std::hash<std::string>()(item.value().dump()));
+    }
+
+    size_t depth = hash_stack.size();
+    if (kind == DefType::Continuation)
+        hash_stack.push_back(name);
+    for (auto& operand : operand_names(desc)) {
+        size_t operand_low;
+        hash = hash_combine(hash, hash_def(defs, operand, operand_low));
+        low = std::min(low, operand_low);
+    }
+    if (kind == DefType::Continuation) {
+        hash_stack.pop_back();
+        if (low >= depth)
+            low = SIZE_MAX;
+    }
+
+    if (low == SIZE_MAX)
+        closed_hashes[name] = hash;
+    else
+        open_hashes[name] = { hash, low };
+    return hash;
+}
+
+/// Hashes all top level definitions of this file and maps the ones that are identical to an already built definition onto it.
+/// Returns the positions of all def descriptions that only those reused definitions depend on.
+std::set<size_t> IRBuilder::dedup_top_level (json& defs, std::map<std::string, std::pair<std::string, size_t>>& roots) {
+    for (auto& [name, positions] : def_index) {
+        auto& desc = defs[positions.back()];
+        if (!desc.contains("external"))
+            continue;
+        auto kind = resolvedef(desc["type"]);
+        if (kind == DefType::Global || (kind == DefType::Continuation && desc.contains("app"))) {
+            size_t low;
+            open_hashes.clear();
+            roots[name] = { desc["external"], hash_def(defs, name, low) };
+        }
+    }
+
+    std::set<std::string> reused;
+    for (auto& [name, root] : roots) {
+        auto cached = def_cache_.top_level.find(root.first);
+        if (cached == def_cache_.top_level.end() || cached->second.hash != root.second)
+            continue;
+        auto def = cached->second.def;
+        known_defs[name] = def;
+        for (auto position : def_index[name]) {
+            auto& desc = defs[position];
+            if (!desc.contains("arg_names"))
+                continue;
+            for (size_t i = 0; i < desc["arg_names"].size(); ++i)
+                known_defs[desc["arg_names"][i]] = def->as<thorin::Continuation>()->param(i);
+        }
+        reused.emplace(name);
+    }
+    def_cache_.reused += reused.size();
+
+    //Reused definitions are already mapped, so the traversal never enters them.
+    auto reach = [&] (std::deque<std::string> queue, std::set<std::string>& seen) {
+        while (!queue.empty()) {
+            auto name = queue.front();
+            queue.pop_front();
+            if (auto param = param_index.find(name); param != param_index.end())
+                name = param->second.first;
+            if (reused.count(name) || !seen.emplace(name).second)
+                continue;
+            auto positions = def_index.find(name);
+            if (positions == def_index.end())
+                continue;
+            for (auto position : positions->second) {
+                for (auto& operand : operand_names(defs[position]))
+                    queue.push_back(operand);
+            }
+        }
+    };
+
+    std::deque<std::string> reused_operands;
+    for (auto& name : reused) {
+        for (auto position : def_index[name]) {
+            for (auto& operand : operand_names(defs[position]))
+                reused_operands.push_back(operand);
+        }
+    }
+    std::set<std::string> reused_reach;
+    reach(reused_operands, reused_reach);
+
+    //External definitions are linked by name only, so a reused root may refer to one whose body first appears in this file.
+    //Every root that is not reused is therefore built, even if a reused root reaches it as well.
+    std::deque<std::string> kept;
+    for (auto& [name, _] : def_index) {
+        if (!reused.count(name) && (!reused_reach.count(name) || roots.count(name)))
+            kept.push_back(name);
+    }
+    std::set<std::string> kept_reach;
+    reach(kept, kept_reach);
+
+    std::set<size_t> skipped;
+    for (auto& [name, positions] : def_index) {
+        if (!reused.count(name) && (!reused_reach.count(name) || kept_reach.count(name)))
+            continue;
+        if (!reused.count(name) && defs[positions.back()].contains("external"))
+            continue;
+        skipped.insert(positions.begin(), positions.end());
+    }
+    return skipped;
+}
+
+void IRBuilder::index_defs (json& defs) {
+    for (size_t i = 0; i < defs.size(); ++i) {
+        auto& desc = defs[i];
+        std::string name = desc["name"];
+        def_index[name].push_back(i);
+        if (desc.contains("arg_names")) {
+            for (size_t j = 0; j < desc["arg_names"].size(); ++j)
+                param_index[desc["arg_names"][j]] = { name, j };
+        }
+    }
+}
+
+/// Builds all not yet built descriptions at positions, so that operands can be referenced before they are defined in the file.
+/// Unbuilt operands are built first from an explicit worklist, so long dependency chains do not nest on the call stack.
+/// Returns false if all of them are already being built, which means that the def depends on itself.
+bool IRBuilder::build_pending (const std::vector<size_t>& positions) {
+    //Entries are (position, operands pushed), a position counts as built once its operands are pushed.
+    std::vector<std::pair<size_t, bool>> worklist;
+    auto push = [&] (const std::vector<size_t>& pending) {
+        for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+            if (!built_positions.count(*it))
+                worklist.emplace_back(*it, false);
+        }
+    };
+    auto desc_at = [&] (size_t position) {
+        return version_ == 2 ? DefDesc((*pending_defs_)[position], position) : DefDesc((*pending_defs_)[position]);
+    };
+
+    push(positions);
+    if (worklist.empty())
+        return false;
+
+    while (!worklist.empty()) {
+        auto [position, expanded] = worklist.back();
+        auto desc = desc_at(position);
+        if (expanded) {
+            worklist.pop_back();
+            reconstruct_def(desc);
+            continue;
+        }
+        if (!built_positions.emplace(position).second) {
+            worklist.pop_back();
+            continue;
+        }
+        worklist.back().second = true;
+
+        //Continuations are declared up front, so only plain defs referenced by name or position are left to build.
+        for (auto operand : operand_refs(desc)) {
+            if (operand->is_number()) {
+                size_t id = *operand;
+                if (id < indexed_defs.size() && !indexed_defs[id])
+                    push({ id });
+            } else if (operand->is_string() && !known_defs.count(*operand)) {
+                if (auto pending = def_index.find(*operand); pending != def_index.end())
+                    push(pending->second);
+            }
+        }
+    }
+
+    return true;
+}
+
+/// Debug names of version 2 defs, an object from positions to names.
+void IRBuilder::register_names (json& names) {
+    for (auto& item : names.items()) {
+        auto& key = item.key();
+        char* end = nullptr;
+        size_t position = std::strtoul(key.c_str(), &end, 10);
+        auto def = key.empty() || *end ? nullptr : find_def(position);
+        if (!def || !item.value().is_string()) {
+            std::cerr << "Warning: ignoring the name of " << key << ", it is no def position with a string name" << std::endl;
+            continue;
+        }
+        known_defs[item.value()] = def;
+    }
+}
+
+void IRBuilder::reconstruct_defs (json& defs, int version) {
+    std::map<std::string, std::pair<std::string, size_t>> roots;
+    std::set<size_t> skipped;
+    version_ = version;
+    if (version == 2) {
+        indexed_defs.assign(defs.size(), nullptr);
+    } else {
+        index_defs(defs);
+        if (def_cache_.enabled)
+            skipped = dedup_top_level(defs, roots);
+    }
+    auto desc_at = [&] (size_t position) {
+        return version == 2 ? DefDesc(defs[position], position) : DefDesc(defs[position]);
+    };
+
+    //Defs may come in any order: all continuations are declared up front and serve as placeholders,
+    //all other defs are built on demand once something references them,
+    //and the continuation bodies are filled in as fixups at the end of the file.
+    pending_defs_ = &defs;
+    built_positions = skipped;
+    std::vector<size_t> fixups;
+    for (size_t i = 0; i < defs.size(); ++i) {
+        if (skipped.count(i))
+            continue;
+        auto desc = desc_at(i);
+        if (resolvedef(desc.kind()) != DefType::Continuation)
+            continue;
+        declare_continuation(desc);
+        built_positions.emplace(i);
+        fixups.push_back(i);
+    }
+
+    for (size_t i = 0; i < defs.size(); ++i) {
+        if (built_positions.emplace(i).second)
+            reconstruct_def(desc_at(i));
+    }
+
+    for (auto position : fixups) {
+        auto desc = desc_at(position);
+        define_continuation(find_def(desc)->as_nom<thorin::Continuation>(), desc);
+    }
+    pending_defs_ = nullptr;
+
+    for (auto& [name, root] : roots)
+        def_cache_.top_level.emplace(root.first, DefCache::Entry { root.second, known_defs[name] });
+    def_cache_.skipped += skipped.size();
+    def_cache_.total += defs.size();
 }
 
 }
@@ -0,0 +1,124 @@
+#include "anyopt/llvmout.h"
+
+#ifdef ENABLE_LLVM
+#include<llvm/Config/llvm-config.h>
+#include<llvm/Bitcode/BitcodeWriter.h>
+#include<llvm/IR/LegacyPassManager.h>
+#include<llvm/IR/Module.h>
+#if LLVM_VERSION_MAJOR >= 14
+#include<llvm/MC/TargetRegistry.h>
+#else
+#include<llvm/Support/TargetRegistry.h>
+#endif
+#if LLVM_VERSION_MAJOR >= 17
+#include<llvm/TargetParser/Host.h>
+#else
+#include<llvm/Support/Host.h>
+#endif
+#include<llvm/Support/TargetSelect.h>
+#include<llvm/Support/raw_os_ostream.h>
+#include<llvm/Target/TargetMachine.h>
+#include<llvm/Target/TargetOptions.h>
+
+#include<algorithm>
+#include<mutex>
+#endif
+
+namespace anyopt {
+
+const char* module_format_extension (ModuleFormat format) {
+    switch (format) {
+        case ModuleFormat::Bitcode: return ".bc";
+        case ModuleFormat::Object: return ".o";
+        default: return ".ll";
+    }
+}
+
+#ifdef ENABLE_LLVM
+//Spellings of the code generation options that changed between LLVM releases.
+#if LLVM_VERSION_MAJOR >= 18
+typedef llvm::CodeGenOptLevel CodeGenLevel;
+static const CodeGenLevel CodeGenLevels[] = { CodeGenLevel::None, CodeGenLevel::Less, CodeGenLevel::Default, CodeGenLevel::Aggressive };
+static const auto ObjectFileType = llvm::CodeGenFileType::ObjectFile;
+#else
+typedef llvm::CodeGenOpt::Level CodeGenLevel;
+static const CodeGenLevel CodeGenLevels[] = { llvm::CodeGenOpt::None, llvm::CodeGenOpt::Less, llvm::CodeGenOpt::Default, llvm::CodeGenOpt::Aggressive };
+static const auto ObjectFileType = llvm::CGFT_ObjectFile;
+#endif
+#if LLVM_VERSION_MAJOR >= 16
+static const auto NoCodeModel = std::nullopt;
+#else
+static const auto NoCodeModel = llvm::None;
+#endif
+
+static bool write_object (llvm::Module& module, std::ostream& out, int opt_level, const std::string& cpu, const std::string& attr) {
+    //Only object emission needs the targets, and they may be requested from several threads at once.
+    static std::once_flag targets_initialized;
+    std::call_once(targets_initialized, [] () {
+        llvm::InitializeAllTargetInfos();
+        llvm::InitializeAllTargets();
+        llvm::InitializeAllTargetMCs();
+        llvm::InitializeAllAsmPrinters();
+    });
+
+    std::string triple = module.getTargetTriple();
+    if (triple.empty()) {
+        triple = llvm::sys::getDefaultTargetTriple();
+        module.setTargetTriple(triple);
+    }
+
+    std::string error;
+    auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target) {
+        std::cerr << "cannot emit an object file for " << triple << ": " << error << std::endl;
+        return false;
+    }
+
+    std::string target_cpu = cpu;
+    if (target_cpu.empty())
+        target_cpu = triple == llvm::sys::getDefaultTargetTriple() ? llvm::sys::getHostCPUName().str() : "generic";
+
+    auto level = CodeGenLevels[std::min(std::max(opt_level, 0), 3)];
+
+    std::unique_ptr<llvm::TargetMachine> machine(target->createTargetMachine(triple, target_cpu, attr, llvm::TargetOptions(), llvm::Reloc::PIC_, NoCodeModel, level));
+    if (!machine) {
+        std::cerr << "cannot create a target machine for " << triple << " (" << target_cpu << ")" << std::endl;
+        return false;
+    }
+    if (module.getDataLayout().isDefault())
+        module.setDataLayout(machine->createDataLayout());
+
+    //The object writer seeks back into its output, so the object is assembled in memory and copied out in one go.
+    llvm::SmallVector<char, 0> buffer;
+    llvm::raw_svector_ostream stream(buffer);
+    llvm::legacy::PassManager passes;
+    if (machine->addPassesToEmitFile(passes, stream, nullptr, ObjectFileType)) {
+        std::cerr << "target " << triple << " cannot emit object files" << std::endl;
+        return false;
+    }
+    passes.run(module);
+
+    out.write(buffer.data(), buffer.size());
+    return bool(out);
+}
+
+bool write_module (llvm::Module& module, std::ostream& out, ModuleFormat format, int opt_level, const std::string& cpu, const std::string& attr) {
+    if (format == ModuleFormat::Object)
+        return write_object(module, out, opt_level, cpu, attr);
+
+    llvm::raw_os_ostream stream(out);
+    if (format == ModuleFormat::Bitcode)
+        llvm::WriteBitcodeToFile(module, stream);
+    else
+        module.print(stream, nullptr);
+    stream.flush();
+    return bool(out);
+}
+#else
+bool write_module (llvm::Module&, std::ostream&, ModuleFormat, int, const std::string&, const std::string&) {
+    std::cerr << "anyopt was built without LLVM support, cannot write LLVM modules" << std::endl;
+    return false;
+}
+#endif
+
+}
@@ -0,0 +1,48 @@
+#include "anyopt/loader.h"
+
+namespace anyopt {
+
+bool Loader::load(json& data, const std::string& filename, std::function<void(IRBuilder&)> inspect) {
+    int version = data.value("version", 1);
+    if (version != 1 && version != 2) {
+        std::cerr << "Unsupported schema version " << version << " in " << filename << std::endl;
+        return false;
+    }
+
+    TypeTable table(thorin_, type_cache_);
+    table.reconstruct_types(data["type_table"], version);
+
+    IRBuilder irbuilder(thorin_, table, extern_globals_, def_cache_);
+    irbuilder.reconstruct_defs(data["defs"], version);
+    if (data.contains("names"))
+        irbuilder.register_names(data["names"]);
+
+    if (inspect)
+        inspect(irbuilder);
+    return true;
+}
+
+/// Types are built again on demand. Imports, external globals and the top level definitions are looked up by their name,
+/// definitions that are no longer external are dropped from the cache.
+void Loader::rebind() {
+    auto& world = thorin_.world();
+    type_cache_ = TypeCache();
+
+    extern_globals_.clear();
+    for (auto& [name, def] : world.externals()) {
+        auto continuation = def->isa_nom<thorin::Continuation>();
+        if ((continuation && !continuation->has_body()) || def->isa<thorin::Global>())
+            extern_globals_.emplace(name, def);
+    }
+
+    for (auto it = def_cache_.top_level.begin(); it != def_cache_.top_level.end();) {
+        if (auto def = world.externals().lookup(it->first).value_or(nullptr)) {
+            it->second.def = def;
+            ++it;
+        } else {
+            it = def_cache_.top_level.erase(it);
+        }
+    }
+}
+
+}
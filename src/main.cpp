@@ -1,17 +1,46 @@
 #include "anyopt/main.h"
 #include "anyopt/typetable.h"
 #include "anyopt/irbuilder.h"
+#include "anyopt/loader.h"
 #include "anyopt/tables/optpasses.h"
 
 #include "anyopt/analysis.h"
+#include "anyopt/stream.h"
+#include "anyopt/verify.h"
+#include "anyopt/parallel.h"
+#include "anyopt/multiisa.h"
+#include "anyopt/profile.h"
+#include "anyopt/promote_globals.h"
+#include "anyopt/heap_to_stack.h"
+#include "anyopt/digest.h"
 
 #include<iostream>
 #include<fstream>
+#include<sstream>
+#include<set>
+#include<algorithm>
+#include<chrono>
+#include<cctype>
+#include<cerrno>
+#include<cstdio>
+#include<map>
+#include<functional>
+#include<iomanip>
+
+#include<sys/resource.h>
+#include<sys/stat.h>
+#include<unistd.h>
+#ifdef __linux__
+#include<poll.h>
+#include<sys/inotify.h>
+#endif
 
 #include<thorin/world.h>
 #include<thorin/be/codegen.h>
 #include<thorin/be/llvm/llvm.h>
 #include<thorin/be/llvm/cpu.h>
+#include<llvm/IR/LLVMContext.h>
+#include<llvm/IR/Module.h>
 
 #include<thorin/be/c/c.h>
 #include<thorin/be/json/json.h>
@@ -23,6 +52,7 @@
 #include<thorin/transform/dead_load_opt.h>
 #include<thorin/transform/flatten_tuples.h>
 #include<thorin/transform/hoist_enters.h>
+#include<thorin/transform/importer.h>
 #include<thorin/transform/inliner.h>
 #include<thorin/transform/lift_builtins.h>
 #include<thorin/transform/partial_evaluation.h>
@@ -31,7 +61,7 @@
 using namespace anyopt;
 
 static void usage() {
-    std::cout << "usage: anyopt [options] files...\n"
+    std::cout << "usage: anyopt [options] files... (- reads stdin)\n"
                 "options:\n"
                 "  -h     --help                 Displays this message\n"
                 "         --version              Displays the version number\n"
@@ -43,13 +73,42 @@ static void usage() {
                 "         --tab-width <n>        Sets the width of the TAB character in error messages or when printing the AST (in spaces, defaults to 2)\n"
                 "         --emit-c               Emits C code in the output file\n"
                 "         --emit-llvm            Emits LLVM IR in the output file\n"
+                "         --emit-bc              Emits LLVM bitcode in the output file\n"
+                "         --emit-obj             Emits a native object file for the host triple and cpu in the output file\n"
+                "         --host-cpu <cpus>      Sets the cpu for LLVM IR. A comma separated list emits one variant per cpu and <name>.dispatch.c,\n"
+                "                                which picks the last listed cpu the running machine supports (the first one is the fallback)\n"
+                "         --compress <fmt>       Compresses the emitted Thorin and LLVM IR (fmt = gz or zst), compressed inputs are detected automatically\n"
                 "  -On                           Sets the optimization level (n = 0, 1, 2, or 3, defaults to 0)\n"
                 "  -p     --pass                 Manually supply passes that are going to be executed. Passes are:\n"
 #define MAP(CLASS, ALIAS, PASS) "                                   " #ALIAS "\n"
             OptPassesEnum(MAP)
 #undef MAP
+                "         --export-list <file>   Internalizes all externals that are not listed in <file> (one name per line) before optimization\n"
                 "  -s     --scope                Compute scope of a given continuation and print the names of all definitions that belong to it.\n"
+                "         --analyze <names>      Prints sizes, loop depth and calls of the scopes of the given externals (comma separated, or all) as JSON\n"
+                "  -j <n>                        Sets the number of threads used by --host-cpu lists and --analyze (defaults to the number of hardware threads)\n"
+                "                                Under make, every thread beyond the first also needs a token from its jobserver\n"
                 "         --passes               Displays the normal optimization pass chain\n"
+                "         --checkpoint-after <pass>  Writes the world to <name>.<pass>.ckpt.json after the first run of <pass>\n"
+                "         --resume-from <file>   Loads a checkpoint and continues with the passes that follow it\n"
+                "         --size-budget <f>      Reverts inliner and pe when they grow the world by more than a factor of f\n"
+                "                                lower2cff is required for code generation, it is only reported when it exceeds the budget\n"
+                "                                The budget applies to the whole world, the scopes that grew the most are only reported\n"
+                "         --verify-each          Verifies the defs each pass created or rewrote, and their users\n"
+                "         --verify-sample <r>    Runs a full verification after a fraction r of the passes (with --verify-each, defaults to 0)\n"
+                "         --watch                Keeps running and rebuilds whenever an input file changes. Only the changed files and\n"
+                "                                the files sharing their definitions are loaded again, all passes run on every rebuild\n"
+                "         --fast-exit            Exits right after the outputs are written, without tearing down the world\n"
+                "         --out <ext>=<target>   Writes the output with extension <ext> (ll, c, json, bc, o, ...) to <target>:\n"
+                "                                - for stdout, fd:N for an open file descriptor, or a file name\n"
+                "         --profile <file>       Reads execution counts of continuations (a JSON object from names to counts, internal\n"
+                "                                continuations are keyed <file>:<name> with several input files) and\n"
+                "                                runs pgo_inline before lower2cff in the normal pass chain. Only inlining uses the counts,\n"
+                "                                partial evaluation and the other passes treat hot and cold code alike\n"
+                "         --profile-hot <f>      Call sites that run at least a fraction f of the hottest count are hot (defaults to 0.01)\n"
+                "         --pe-cache <dir>       Reuses the results of pe and lower2cff for the unchanged parts of the world from earlier builds\n"
+                "         --heap-to-stack-limit <bytes>  Largest allocation heap_to_stack moves to the stack (defaults to 4096)\n"
+                "         --time-report <file>   Writes the time spent loading, optimizing and generating code, and the peak memory use as JSON\n"
                 "  -o <name>                     Sets the module name (defaults to the first file name without its extension)\n"
                 ;
 }
@@ -81,27 +140,44 @@ static void version() {
              <<  " (" << build << ")\n";
 }
 
-static void passes() {
-    std::cout << "--pass cleanup "
-              << "--pass lower2cff "
-              << "--pass flatten_tuples "
-              << "--pass split_slots "
-              << "--pass closure_conversion "
-              << "--pass lift_builtins "
-              << "--pass inliner "
-              << "--pass hoist_enters "
-              << "--pass dead_load_opt "
-              << "--pass cleanup "
-              << "--pass codegen_prepare"
-              << "\n";
-}
-
 enum OptimizerPass {
 #define MAP(CLASS, ALIAS, PASS) CLASS,
 OptPassesEnum(MAP)
 #undef MAP
 };
 
+static const OptimizerPass default_passes[] = {
+    Cleanup,
+    Lower2CFF,
+    Flatten_Tuples,
+    Split_Slots,
+    Closure_Conversion,
+    Lift_Builtins,
+    Inliner,
+    Hoist_Enters,
+    Dead_Load_Opt,
+    Cleanup,
+    Codegen_Prepare,
+};
+
+static const char* pass_name(OptimizerPass pass) {
+    switch (pass) {
+#define MAP(CLASS, ALIAS, PASS) case CLASS: return #ALIAS;
+        OptPassesEnum(MAP)
+#undef MAP
+    }
+    return "";
+}
+
+static void passes() {
+    const char* separator = "";
+    for (auto pass : default_passes) {
+        std::cout << separator << "--pass " << pass_name(pass);
+        separator = " ";
+    }
+    std::cout << "\n";
+}
+
 struct ProgramOptions {
     std::vector<std::string> files;
     std::vector<OptimizerPass> optimizer_passes;
@@ -117,11 +193,30 @@ struct ProgramOptions {
     bool emit_c = false;
     bool emit_json = false;
     bool emit_llvm = false;
+    bool emit_bc = false;
+    bool emit_obj = false;
+    Compression compression = Compression::None;
     std::string host_triple;
     std::string host_cpu;
     std::string host_attr;
     std::string hls_flags;
     std::string compute_scope;
+    std::string analyze;
+    size_t jobs = anyopt::default_jobs();
+    std::string export_list;
+    std::string checkpoint_after;
+    std::string resume_from;
+    double size_budget = 0;
+    bool verify_each = false;
+    std::string time_report;
+    bool watch = false;
+    std::string profile;
+    std::string pe_cache;
+    double profile_hot = 0.01;
+    size_t heap_to_stack_limit = 4096;
+    std::map<std::string, std::string> outputs;
+    bool fast_exit = false;
+    double verify_sample = 0;
     bool show_implicit_casts = false;
     unsigned opt_level = 0;
     size_t max_errors = 0;
@@ -149,7 +244,7 @@ struct ProgramOptions {
         }
 
         for (int i = 1; i < argc; i++) {
-            if (argv[i][0] == '-') {
+            if (argv[i][0] == '-' && argv[i][1] != 0) {
                 if (matches(argv[i], "-h", "--help")) {
                     usage();
                     exit = true;
@@ -216,12 +311,123 @@ struct ProgramOptions {
                     if (!check_arg(argc, argv, i))
                         return false;
                     compute_scope = argv[++i];
+                } else if (matches(argv[i], "--analyze")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    analyze = argv[++i];
+                } else if (matches(argv[i], "-j")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    jobs = std::strtoul(argv[++i], NULL, 10);
+                    if (jobs == 0) {
+                        std::cerr << "-j needs a positive number of threads" << std::endl;
+                        return false;
+                    }
+                } else if (matches(argv[i], "--export-list")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    export_list = argv[++i];
+                } else if (matches(argv[i], "--checkpoint-after")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    checkpoint_after = argv[++i];
+                    bool known = false;
+#define MAP(CLASS, ALIAS, PASS) known |= checkpoint_after == #ALIAS;
+                    OptPassesEnum(MAP)
+#undef MAP
+                    if (!known) {
+                        std::cerr << "Did not recognize pass \"" << checkpoint_after << "\"" << std::endl;
+                        return false;
+                    }
+                } else if (matches(argv[i], "--size-budget")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    size_budget = std::strtod(argv[++i], NULL);
+                    if (size_budget <= 0) {
+                        return false;
+                    }
+                } else if (matches(argv[i], "--watch")) {
+                    watch = true;
+                } else if (matches(argv[i], "--fast-exit")) {
+                    fast_exit = true;
+                } else if (matches(argv[i], "--out")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    std::string route = argv[++i];
+                    auto split = route.find('=');
+                    if (split == std::string::npos || split == 0 || split + 1 == route.size()) {
+                        std::cerr << "--out expects <ext>=<target>, got '" << route << "'" << std::endl;
+                        return false;
+                    }
+                    auto ext = route.substr(0, split);
+                    if (ext[0] == '.')
+                        ext.erase(0, 1);
+                    outputs[ext] = route.substr(split + 1);
+                } else if (matches(argv[i], "--profile")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    profile = argv[++i];
+                } else if (matches(argv[i], "--profile-hot")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    profile_hot = std::strtod(argv[++i], NULL);
+                    if (profile_hot <= 0 || profile_hot > 1) {
+                        std::cerr << "--profile-hot expects a fraction in (0, 1]" << std::endl;
+                        return false;
+                    }
+                } else if (matches(argv[i], "--pe-cache")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    pe_cache = argv[++i];
+                } else if (matches(argv[i], "--heap-to-stack-limit")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    char* end;
+                    auto limit = argv[++i];
+                    heap_to_stack_limit = std::strtoull(limit, &end, 10);
+                    if (!std::isdigit(static_cast<unsigned char>(limit[0])) || *end != '\0') {
+                        std::cerr << "--heap-to-stack-limit expects a number of bytes" << std::endl;
+                        return false;
+                    }
+                } else if (matches(argv[i], "--time-report")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    time_report = argv[++i];
+                } else if (matches(argv[i], "--verify-each")) {
+                    verify_each = true;
+                } else if (matches(argv[i], "--verify-sample")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    verify_sample = std::strtod(argv[++i], NULL);
+                    if (verify_sample < 0 || verify_sample > 1) {
+                        return false;
+                    }
+                } else if (matches(argv[i], "--resume-from")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    resume_from = argv[++i];
                 } else if (matches(argv[i], "--tab-width")) {
                     if (!check_arg(argc, argv, i))
                         return false;
                     tab_width = std::strtoull(argv[++i], NULL, 10);
                 } else if (matches(argv[i], "--emit-llvm")) {
                     emit_llvm = true;
+                } else if (matches(argv[i], "--emit-bc")) {
+                    emit_bc = true;
+                } else if (matches(argv[i], "--emit-obj")) {
+                    emit_obj = true;
+                } else if (matches(argv[i], "--compress")) {
+                    if (!check_arg(argc, argv, i))
+                        return false;
+                    i++;
+                    using namespace std::string_literals;
+                    if (argv[i] == "gz"s)
+                        compression = Compression::Gzip;
+                    else if (argv[i] == "zst"s)
+                        compression = Compression::Zstd;
+                    else {
+                        return false;
+                    }
                 } else if (matches(argv[i], "--emit-c")) {
                     emit_c = true;
                 } else if (matches(argv[i], "--host-triple")) {
@@ -271,89 +477,919 @@ void lower2cff (thorin::Thorin& thorin) {
     while(partial_evaluation(thorin.world(), true));
 }
 
+/// Changes whenever the world may have been replaced by a new one, see IncrementalVerifier.
+static size_t world_generation = 0;
+
+/// Imports everything that is still live into a fresh world, like Thorin's own cleanup. The profile counts move along.
+void cleanup_world (thorin::Thorin& thorin, ContinuationCounts& counts) {
+    world_generation++;
+    //The importer simplifies while it copies and tells whether another round would simplify more.
+    bool todo = true;
+    while (todo) {
+        auto& world = thorin.world();
+        thorin::Importer importer(world);
+        for (auto& [name, def] : world.externals())
+            importer.import(def);
+        if (world.is_pe_done())
+            importer.world().mark_pe_done();
+        counts = import_counts(counts, importer);
+        todo = importer.todo_;
+        thorin.world_container().swap(importer.world_);
+    }
+}
+
 void mark_pe_done (thorin::Thorin& thorin) {
     thorin.world().mark_pe_done();
 }
 
-int main (int argc, char** argv) {
-    ProgramOptions opts;
-    if (!opts.parse(argc, argv))
-        return EXIT_FAILURE;
-    if (opts.exit)
-        return EXIT_SUCCESS;
+bool internalize (thorin::Thorin& thorin, const std::string& export_list, ContinuationCounts& counts) {
+    std::ifstream list_file(export_list);
+    if (!list_file) {
+        std::cerr << "cannot open '" << export_list << "' for reading" << std::endl;
+        return false;
+    }
 
-    if (opts.files.empty()) {
-        std::cerr << "no input files" << std::endl;
-        return EXIT_FAILURE;
+    std::set<std::string> exports;
+    for (std::string line; std::getline(list_file, line);) {
+        auto begin = line.find_first_not_of(" \t\r");
+        if (begin == std::string::npos || line[begin] == '#')
+            continue;
+        auto end = line.find_last_not_of(" \t\r");
+        exports.emplace(line.substr(begin, end - begin + 1));
     }
 
-    if (opts.module_name == "") {
-        std::ifstream json_input_file(opts.files[0]);
-        json data = json::parse(json_input_file);
-        opts.module_name = data["module"].get<std::string>();
+    auto& world = thorin.world();
+    auto before = world_stats(world);
+
+    std::vector<thorin::Def*> stripped;
+    for (auto& [name, def] : world.externals()) {
+        if (exports.count(name)) {
+            exports.erase(name);
+            continue;
+        }
+        //Imports have no body in this module, internalizing them would only break the link.
+        if (auto continuation = def->isa_nom<thorin::Continuation>(); continuation && !continuation->has_body())
+            continue;
+        if (auto global = def->isa<thorin::Global>(); global && global->init()->isa<thorin::Bottom>())
+            continue;
+        stripped.push_back(def);
     }
+    for (auto& name : exports)
+        std::cerr << "Warning: exported symbol " << name << " is not defined in this module" << std::endl;
 
-    thorin::Thorin thorin(opts.module_name);
-    thorin.world().set(opts.log_level);
-    thorin.world().set(std::make_shared<thorin::Stream>(std::cerr));
+    for (auto def : stripped)
+        world.make_internal(def);
+    cleanup_world(thorin, counts);
 
-    thorin::World::Externals extern_globals;
+    auto after = world_stats(thorin.world());
+    std::cerr << "Internalized " << stripped.size() << " externals, stripped "
+              << before.continuations - after.continuations << " continuations and "
+              << before.primops - after.primops << " primops" << std::endl;
+    return true;
+}
 
-    for (auto filename : opts.files) {
-        std::ifstream json_input_file(filename);
-        json data = json::parse(json_input_file);
+std::unique_ptr<thorin::Thorin> make_thorin (ProgramOptions& opts) {
+    world_generation++;
+    auto thorin = std::make_unique<thorin::Thorin>(opts.module_name);
+    thorin->world().set(opts.log_level);
+    thorin->world().set(std::make_shared<thorin::Stream>(std::cerr));
+    return thorin;
+}
 
-        if (data.contains("host_triple")) {
-            if (opts.host_triple == "") {
-                opts.host_cpu = data["host_triple"];
-            } else if (opts.host_triple != data["host_triple"]) {
-                std::cerr << "Warning: Previously supplied host triple is different from the one in " << filename << std::endl;
-                opts.host_cpu = data["host_triple"];
+/// What passes work with besides the world: the profile given with --profile, the counts of the current world's continuations
+/// and the settings of individual passes. Whoever replaces the world moves the counts along or clears them.
+struct PassContext {
+    const Profile* profile = nullptr;
+    ContinuationCounts counts;
+    size_t heap_to_stack_limit = 4096;
+};
+
+void run_pass (thorin::Thorin& thorin, OptimizerPass pass, PassContext& context) {
+    switch (pass) {
+#define MAP(CLASS, ALIAS, PASS) case CLASS: std::cerr << #ALIAS << std::endl; PASS(thorin, context); break;
+        OptPassesEnum(MAP)
+#undef MAP
+    }
+}
+
+/// Serializes the world through the JSON backend, in the same format anyopt reads its input from.
+json snapshot (thorin::Thorin& thorin, ProgramOptions& opts) {
+    std::stringstream stream;
+    thorin::json::CodeGen cg(thorin, opts.debug, opts.host_triple, opts.host_cpu, opts.host_attr);
+    cg.emit_stream(stream);
+    return json::parse(stream);
+}
+
+/// Checkpoints are regular input modules with the passes that already ran recorded in "checkpoint".
+bool write_checkpoint (thorin::Thorin& thorin, ProgramOptions& opts, const std::vector<OptimizerPass>& pipeline, size_t passes_done) {
+    json data = snapshot(thorin, opts);
+    json done = json::array();
+    for (size_t i = 0; i < passes_done; ++i)
+        done.push_back(pass_name(pipeline[i]));
+    data["checkpoint"] = { { "passes", done }, { "pe_done", thorin.world().is_pe_done() } };
+
+    auto name = opts.module_name + "." + pass_name(pipeline[passes_done - 1]) + ".ckpt.json" + compression_extension(opts.compression);
+    auto file = open_output(name, opts.compression);
+    if (!file) {
+        std::cerr << "cannot open '" << name << "' for writing" << std::endl;
+        return false;
+    }
+    *file << data;
+    std::cerr << "Wrote checkpoint " << name << std::endl;
+    return true;
+}
+
+static size_t world_size (thorin::World& world) {
+    auto stats = world_stats(world);
+    return stats.continuations + stats.primops;
+}
+
+static void report_scope_growth (const std::map<std::string, size_t>& before, const std::map<std::string, size_t>& after, double factor) {
+    std::vector<std::pair<double, std::string>> grown;
+    for (auto& [name, size] : after) {
+        auto old_size = before.find(name);
+        if (old_size == before.end() || old_size->second == 0)
+            continue;
+        double growth = double(size) / old_size->second;
+        if (growth > factor)
+            grown.emplace_back(growth, name);
+    }
+    std::sort(grown.rbegin(), grown.rend());
+    for (size_t i = 0; i < grown.size() && i < 5; ++i)
+        std::cerr << "  scope " << grown[i].second << " grew by a factor of " << grown[i].first << std::endl;
+}
+
+/// A copy of the world of thorin, which is left as it is. copied receives counts moved to the copy's continuations.
+static std::unique_ptr<thorin::Thorin> copy_world (ProgramOptions& opts, thorin::Thorin& thorin, const ContinuationCounts& counts, ContinuationCounts& copied) {
+    auto& from = thorin.world();
+    auto copy = std::make_unique<thorin::Thorin>(opts.module_name);
+    thorin::Importer importer(from);
+    for (auto& [name, def] : from.externals())
+        importer.import(def);
+    copied = import_counts(counts, importer);
+    copy->world_container().swap(importer.world_);
+    copy->world().set(opts.log_level);
+    copy->world().set(std::make_shared<thorin::Stream>(std::cerr));
+    if (from.is_pe_done())
+        copy->world().mark_pe_done();
+    return copy;
+}
+
+/// Runs inliner or pe under the size budget: if the pass grows the world beyond opts.size_budget times its size, the world is
+/// restored from a copy taken before the pass. Partial evaluation is then rerun on another copy with one round less than the one
+/// that exceeded the budget. Lower2cff is always kept and needs no copy. The budget applies to the world as a whole,
+/// the scopes that grew the most are only reported.
+void run_budgeted_pass (std::unique_ptr<thorin::Thorin>& thorin, ProgramOptions& opts, OptimizerPass pass, PassContext& context) {
+    auto before = world_size(thorin->world());
+    auto limit = size_t(before * opts.size_budget);
+
+    std::unique_ptr<thorin::Thorin> saved;
+    ContinuationCounts saved_counts;
+    if (pass != Lower2CFF)
+        saved = copy_world(opts, *thorin, context.counts, saved_counts);
+
+    size_t done = 0;
+    bool exceeded = false;
+    if (pass == PE) {
+        std::cerr << pass_name(pass) << std::endl;
+        while (partial_evaluation(thorin->world(), false)) {
+            done++;
+            if ((exceeded = world_size(thorin->world()) > limit))
+                break;
+        }
+    } else {
+        run_pass(*thorin, pass, context);
+        exceeded = world_size(thorin->world()) > limit;
+    }
+    if (!exceeded)
+        return;
+
+    std::cerr << "Size budget exceeded by " << pass_name(pass) << ": world grew from " << before << " to "
+              << world_size(thorin->world()) << " defs (limit " << limit << ")" << std::endl;
+    if (pass == Lower2CFF) {
+        std::cerr << "  kept " << pass_name(pass) << ", code generation depends on it" << std::endl;
+        return;
+    }
+    report_scope_growth(scope_sizes(saved->world()), scope_sizes(thorin->world()), opts.size_budget);
+
+    //The world is replaced either way, see IncrementalVerifier.
+    world_generation++;
+    if (pass == PE && done > 1) {
+        ContinuationCounts counts;
+        auto retry = copy_world(opts, *saved, saved_counts, counts);
+        for (size_t i = 0; i + 1 < done; ++i)
+            partial_evaluation(retry->world(), false);
+        if (world_size(retry->world()) <= limit) {
+            std::cerr << "  kept " << done - 1 << " rounds of partial evaluation" << std::endl;
+            thorin = std::move(retry);
+            context.counts = std::move(counts);
+            return;
+        }
+    }
+    std::cerr << "  reverted " << pass_name(pass) << std::endl;
+    thorin = std::move(saved);
+    context.counts = std::move(saved_counts);
+}
+
+/// Groups the externals of world into parts that share no continuation with a body and no global, by their names.
+/// Partial evaluation only follows what a part reaches, so every part can be specialized and cached on its own.
+/// Imports that no other external reaches go with the first part. Parts and the names in them are sorted.
+static std::vector<std::vector<std::string>> external_parts (thorin::World& world) {
+    std::vector<std::string> names;
+    for (auto& [name, def] : world.externals())
+        names.push_back(name);
+    std::sort(names.begin(), names.end());
+
+    std::vector<size_t> parent(names.size());
+    for (size_t i = 0; i < names.size(); ++i)
+        parent[i] = i;
+    auto find = [&] (size_t i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    //Imports and intrinsics are recreated by name when a part is loaded, everything else belongs to exactly one part.
+    auto owned = [&] (const thorin::Def* def) {
+        if (def->isa<thorin::Global>())
+            return true;
+        auto continuation = def->isa_nom<thorin::Continuation>();
+        return continuation && continuation->has_body();
+    };
+
+    std::vector<const thorin::Def*> roots;
+    for (auto& name : names)
+        roots.push_back(world.externals().lookup(name).value_or(nullptr));
+
+    std::unordered_map<const thorin::Def*, size_t> owner;
+    std::set<const thorin::Def*> reached;
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::vector<const thorin::Def*> stack = { roots[i] };
+        std::set<const thorin::Def*> visited;
+        while (!stack.empty()) {
+            auto def = stack.back();
+            stack.pop_back();
+            if (!def || !visited.insert(def).second)
+                continue;
+            if (owned(def)) {
+                auto [it, inserted] = owner.emplace(def, i);
+                if (!inserted)
+                    parent[find(it->second)] = find(i);
+            }
+            if (def != roots[i])
+                reached.insert(def);
+            if (auto continuation = def->isa_nom<thorin::Continuation>()) {
+                if (continuation->has_body())
+                    stack.push_back(continuation->body());
+                stack.push_back(continuation->filter());
+            } else if (auto param = def->isa<thorin::Param>()) {
+                stack.push_back(param->continuation());
+            }
+            for (auto op : def->ops())
+                stack.push_back(op);
+        }
+    }
+
+    std::map<size_t, std::vector<std::string>> parts;
+    std::vector<std::string> unused_imports;
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (!owned(roots[i]) && !reached.count(roots[i]))
+            unused_imports.push_back(names[i]);
+        else
+            parts[find(i)].push_back(names[i]);
+    }
+
+    std::vector<std::vector<std::string>> result;
+    for (auto& [root, part] : parts)
+        result.push_back(std::move(part));
+    if (result.empty())
+        result.emplace_back();
+    result.front().insert(result.front().end(), unused_imports.begin(), unused_imports.end());
+    return result;
+}
+
+/// Appends the structure of type to key: its kind, the parameters of that kind and its operands. Types are numbered in the
+/// order they are met and referred to by their number afterwards, which also ends the recursion of nominal types.
+static void type_key (std::ostream& key, const thorin::Type* type, std::unordered_map<const thorin::Type*, size_t>& numbers) {
+    auto [it, inserted] = numbers.emplace(type, numbers.size());
+    key << "t" << it->second;
+    if (!inserted)
+        return;
+    key << "(" << type->tag();
+    if (auto vector = type->isa<thorin::VectorType>())
+        key << " x" << vector->length();
+    if (auto ptr = type->isa<thorin::PtrType>())
+        key << " @" << static_cast<int>(ptr->addr_space());
+    if (auto array = type->isa<thorin::DefiniteArrayType>())
+        key << " [" << array->dim() << "]";
+    if (auto nominal = type->isa<thorin::NominalType>())
+        key << " " << nominal->name();
+    for (auto op : type->ops()) {
+        key << " ";
+        type_key(key, op, numbers);
+    }
+    key << ")";
+}
+
+/// The structure of the part of world with the given externals, which keys it in the pe cache. Every def the part reaches is
+/// numbered in the order a depth first walk from the externals meets it, and described by its kind, type and operands.
+/// Gids and def names do not enter the key, so a part gets the same key in every run, whatever order its defs were loaded in.
+static std::string part_key (const std::vector<std::string>& names, thorin::World& world,
+                             const std::unordered_map<const thorin::Def*, std::string>& external_names) {
+    std::vector<const thorin::Def*> order;
+    std::unordered_map<const thorin::Def*, size_t> numbers;
+    for (auto& name : names) {
+        std::vector<const thorin::Def*> stack = { world.externals().lookup(name).value_or(nullptr) };
+        while (!stack.empty()) {
+            auto def = stack.back();
+            stack.pop_back();
+            if (!def || !numbers.emplace(def, order.size()).second)
+                continue;
+            order.push_back(def);
+            //Pushed in reverse, so the operands are met in their order.
+            for (size_t i = def->num_ops(); i-- > 0;)
+                stack.push_back(def->op(i));
+            if (auto continuation = def->isa_nom<thorin::Continuation>()) {
+                stack.push_back(continuation->filter());
+                if (continuation->has_body())
+                    stack.push_back(continuation->body());
+            } else if (auto param = def->isa<thorin::Param>()) {
+                stack.push_back(param->continuation());
             }
         }
-        if (data.contains("host_cpu")) {
-            if (opts.host_cpu == "") {
-                opts.host_cpu = data["host_cpu"];
-            } else if (opts.host_cpu != data["host_cpu"]) {
-                std::cerr << "Warning: Previously supplied host cpu is different from the one in " << filename << std::endl;
-                opts.host_cpu = data["host_cpu"];
+    }
+
+    std::stringstream key;
+    std::unordered_map<const thorin::Type*, size_t> types;
+    auto number = [&] (const thorin::Def* def) { return def ? std::to_string(numbers[def]) : std::string("-"); };
+    for (auto& name : names)
+        key << name << " " << number(world.externals().lookup(name).value_or(nullptr)) << "\n";
+    for (auto def : order) {
+        key << def->tag() << " ";
+        type_key(key, def->type(), types);
+        for (auto op : def->ops())
+            key << " " << number(op);
+        if (auto continuation = def->isa_nom<thorin::Continuation>()) {
+            key << " body " << (continuation->has_body() ? number(continuation->body()) : "-")
+                << " filter " << number(continuation->filter())
+                << " " << static_cast<int>(continuation->intrinsic()) << " " << static_cast<int>(continuation->attributes().cc);
+        } else if (auto param = def->isa<thorin::Param>()) {
+            key << " " << number(param->continuation()) << "." << param->index();
+        } else if (auto literal = def->isa<thorin::PrimLit>()) {
+            key << " " << literal->value().get_u64();
+        } else if (auto global = def->isa<thorin::Global>()) {
+            key << " " << global->is_mutable();
+        } else if (auto variant = def->isa<thorin::Variant>()) {
+            key << " " << variant->index();
+        } else if (auto extract = def->isa<thorin::VariantExtract>()) {
+            key << " " << extract->index();
+        } else if (auto assembly = def->isa<thorin::Assembly>()) {
+            key << " " << std::quoted(assembly->asm_template()) << " " << assembly->flags();
+            for (auto constraints : { assembly->output_constraints(), assembly->input_constraints(), assembly->clobbers() }) {
+                key << " [";
+                for (auto& constraint : constraints)
+                    key << " " << std::quoted(constraint);
+                key << " ]";
             }
         }
-        if (data.contains("host_attr")) {
-            if (opts.host_attr == "") {
-                opts.host_cpu = data["host_attr"];
-            } else if (opts.host_attr != data["host_attr"]) {
-                std::cerr << "Warning: Previously supplied host attributes is different from the one in " << filename << std::endl;
-                opts.host_cpu = data["host_attr"];
+        auto external = external_names.find(def);
+        if (external != external_names.end())
+            key << " external " << external->second;
+        key << "\n";
+    }
+    return key.str();
+}
+
+/// A world with the given externals of from and everything they reach.
+static std::unique_ptr<thorin::Thorin> extract_part (ProgramOptions& opts, thorin::World& from, const std::vector<std::string>& names) {
+    auto part = std::make_unique<thorin::Thorin>(opts.module_name);
+    thorin::Importer importer(from);
+    for (auto& name : names)
+        importer.import(from.externals().lookup(name).value_or(nullptr));
+    part->world_container().swap(importer.world_);
+    part->world().set(opts.log_level);
+    part->world().set(std::make_shared<thorin::Stream>(std::cerr));
+    if (from.is_pe_done())
+        part->world().mark_pe_done();
+    return part;
+}
+
+/// Runs pe or lower2cff through the cache in opts.pe_cache. The world is split into parts (see external_parts), and every part
+/// is keyed by the SHA-256 of the pass, the anyopt and Thorin builds and the structure of the part before the pass (see
+/// part_key). An entry holds the part after the pass in the input format and the full digest, which has to match. Without
+/// any hit the pass runs on the world as it is and only its parts are stored. Otherwise only the parts that missed run, and
+/// the world is loaded from all results.
+bool run_cached_pass (std::unique_ptr<thorin::Thorin>& thorin, ProgramOptions& opts, OptimizerPass pass, PassContext& context) {
+    bool pe_done = thorin->world().is_pe_done();
+    std::stringstream header;
+    header << pass_name(pass) << " " << ANYOPT_VERSION_MAJOR << "." << ANYOPT_VERSION_MINOR << " " << ANYOPT_THORIN_BUILD << " "
+           << opts.size_budget << " " << pe_done << "\n";
+
+    struct Part {
+        std::vector<std::string> names;
+        std::string digest;
+        std::string path;
+        json result;
+    };
+    std::vector<Part> parts;
+    size_t hits = 0;
+    std::unordered_map<const thorin::Def*, std::string> external_names;
+    for (auto& [name, def] : thorin->world().externals())
+        external_names.emplace(def, name);
+    for (auto& names : external_parts(thorin->world())) {
+        Part part { names, sha256(header.str() + part_key(names, thorin->world(), external_names)), "", nullptr };
+        part.path = opts.pe_cache + "/" + part.digest.substr(0, 16) + ".json" + compression_extension(opts.compression);
+        if (auto file = open_input(part.path)) {
+            json cached = json::parse(*file, nullptr, false);
+            if (!cached.is_discarded() && cached.contains("pe_cache") && cached["pe_cache"].value("digest", "") == part.digest) {
+                cached.erase("pe_cache");
+                part.result = std::move(cached);
+                hits++;
+            } else {
+                std::cerr << "Warning: ignoring pe cache entry " << part.path << ", it is broken or belongs to another key" << std::endl;
             }
         }
+        parts.push_back(std::move(part));
+    }
+
+    if (mkdir(opts.pe_cache.c_str(), 0777) != 0 && errno != EEXIST) {
+        perror(opts.pe_cache.c_str());
+        return false;
+    }
+    //Written under a temporary name first, concurrent builds only ever see complete entries.
+    auto store = [&] (Part& part, json result) {
+        auto temporary = part.path + "." + std::to_string(getpid()) + ".tmp";
+        result["pe_cache"] = { { "digest", part.digest } };
+        if (auto file = open_output(temporary, opts.compression)) {
+            *file << result.dump() << std::endl;
+            file.reset();
+            if (rename(temporary.c_str(), part.path.c_str()) != 0)
+                perror(part.path.c_str());
+        } else {
+            std::cerr << "cannot open '" << temporary << "' for writing" << std::endl;
+        }
+        result.erase("pe_cache");
+        part.result = std::move(result);
+    };
+
+    if (hits == 0) {
+        if (opts.size_budget > 0)
+            run_budgeted_pass(thorin, opts, pass, context);
+        else
+            run_pass(*thorin, pass, context);
+        for (auto& part : parts)
+            store(part, snapshot(*extract_part(opts, thorin->world(), part.names), opts));
+        return true;
+    }
+
+    std::cerr << pass_name(pass) << " (" << hits << " of " << parts.size() << " parts cached)" << std::endl;
+    //The parts and the world assembled from them carry no profile counts.
+    PassContext part_context { context.profile, {}, context.heap_to_stack_limit };
+    for (auto& part : parts) {
+        if (!part.result.is_null())
+            continue;
+        auto world = extract_part(opts, thorin->world(), part.names);
+        if (opts.size_budget > 0)
+            run_budgeted_pass(world, opts, pass, part_context);
+        else
+            run_pass(*world, pass, part_context);
+        store(part, snapshot(*world, opts));
+    }
+
+    auto assembled = make_thorin(opts);
+    Loader loader(*assembled);
+    for (auto& part : parts) {
+        if (!loader.load(part.result, "pe cache entry " + part.path))
+            return false;
+    }
+    if (pe_done)
+        assembled->world().mark_pe_done();
+    thorin = std::move(assembled);
+    context.counts.clear();
+    return true;
+}
+
+/// Wall clock time of the phases of a run, see --time-report.
+struct TimeReport {
+    typedef std::chrono::steady_clock Clock;
+
+    /// Taken during static initialization, as close to the start of the process as anyopt gets.
+    static const Clock::time_point process_start;
+
+    Clock::time_point mark = Clock::now();
+    double first_pass = 0;
+    double load = 0;
+    double passes = 0;
+    double codegen = 0;
+    double teardown = 0;
+    std::vector<std::pair<std::string, double>> pass_times;
+
+    /// Seconds since the previous lap.
+    double lap () {
+        auto now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - mark).count();
+        mark = now;
+        return seconds;
+    }
+
+    double since_start () const { return std::chrono::duration<double>(Clock::now() - process_start).count(); }
+};
+
+const TimeReport::Clock::time_point TimeReport::process_start = TimeReport::Clock::now();
+
+static bool write_time_report (const std::string& filename, const TimeReport& report) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    json pass_times = json::array();
+    for (auto& [name, seconds] : report.pass_times)
+        pass_times.push_back({ { "pass", name }, { "seconds", seconds } });
+    json data = {
+        { "first_pass", report.first_pass },
+        { "load", report.load },
+        { "passes", report.passes },
+        { "codegen", report.codegen },
+        { "teardown", report.teardown },
+        { "max_rss_kb", usage.ru_maxrss },
+        { "pass_times", pass_times },
+    };
+
+    std::ofstream file(filename);
+    if (!file) {
+        std::cerr << "cannot open '" << filename << "' for writing" << std::endl;
+        return false;
+    }
+    file << data.dump(2) << std::endl;
+    return true;
+}
+
+/// Whether the world contains code for thorin::DeviceBackends: kernels launched through an accelerator intrinsic, or device functions.
+static bool has_device_code (thorin::World& world) {
+    for (auto continuation : world.copy_continuations()) {
+        if (continuation->is_accelerator() || continuation->attributes().cc == thorin::CC::Device)
+            return true;
+    }
+    return false;
+}
+
+/// Parsed input files. Every file is read once per load, and the data is handed over to the loader.
+class InputCache {
+public:
+    /// Parsed contents of filename, or nullptr if it cannot be read or parsed.
+    json* get (const std::string& filename) {
+        auto cached = entries_.find(filename);
+        if (cached != entries_.end())
+            return &cached->second;
+
+        auto file = open_input(filename);
+        if (!file) {
+            std::cerr << "cannot open '" << filename << "' for reading" << std::endl;
+            return nullptr;
+        }
+        try {
+            auto& data = entries_[filename];
+            data = json::parse(*file);
+            return &data;
+        } catch (json::parse_error& error) {
+            std::cerr << "cannot parse '" << filename << "': " << error.what() << std::endl;
+            entries_.erase(filename);
+            return nullptr;
+        }
+    }
+
+    /// Like get, but hands the data over. The next get or take reads the file again.
+    bool take (const std::string& filename, json& data) {
+        auto cached = get(filename);
+        if (!cached)
+            return false;
+        data = std::move(*cached);
+        entries_.erase(filename);
+        return true;
+    }
+
+private:
+    std::map<std::string, json> entries_;
+};
+
+/// The names of the externals an input file defines, and the ones it imports.
+struct ExternalNames {
+    std::set<std::string> defined;
+    std::set<std::string> imported;
+};
+
+/// Loads one input file through loader. The first load of a file also takes the host settings, the module name and the checkpoint from it.
+/// The names of the externals the file defines and imports are added to names.
+static bool load_input (Loader& loader, ProgramOptions& opts, InputCache& inputs, const std::string& filename, bool first,
+                        json& checkpoint, const std::function<void(IRBuilder&)>& inspect, ExternalNames* names = nullptr) {
+    json data;
+    if (!inputs.take(filename, data))
+        return false;
+
+    if (first) {
+        //Values from the command line or an earlier file win, --host-cpu may list several cpus that no file can match.
+        auto inherit = [&] (std::string& value, const char* field, const char* what) {
+            if (!data.contains(field))
+                return;
+            if (value == "")
+                value = data[field];
+            else if (value != data[field])
+                std::cerr << "Warning: keeping the previously supplied " << what << " " << value << " over the one in " << filename << std::endl;
+        };
+        inherit(opts.host_triple, "host_triple", "host triple");
+        inherit(opts.host_cpu, "host_cpu", "host cpu");
+        inherit(opts.host_attr, "host_attr", "host attributes");
 
         if (opts.module_name == "")
             opts.module_name = data["module"].get<std::string>();
 
-        TypeTable table(thorin);
-        for (auto it : data["type_table"])
-            table.reconstruct_type(it);
+        if (data.contains("checkpoint"))
+            checkpoint = data["checkpoint"];
+    }
+
+    if (names && data.contains("defs")) {
+        auto& defs = data["defs"];
+        bool positional = data.value("version", 1) == 2;
+        for (size_t i = 0; i < defs.size(); ++i) {
+            auto desc = positional ? DefDesc(defs[i], i) : DefDesc(defs[i]);
+            if (desc.contains("external"))
+                names->defined.emplace(desc["external"].get<std::string>());
+            if (desc.contains("internal"))
+                names->imported.emplace(desc["internal"].get<std::string>());
+        }
+    }
+
+    return loader.load(data, filename, inspect);
+}
+
+/// The world of --watch before any pass ran. It is kept across rebuilds: the externals of a changed file are internalized
+/// and cleaned up, and only that file and the files that share its definitions are loaded again. Every build runs the
+/// whole pipeline on a copy of it, only loading is incremental.
+class WarmWorld {
+public:
+    WarmWorld(ProgramOptions& opts, InputCache& inputs, Profile* profile)
+        : opts_(opts), inputs_(inputs), profile_(profile), thorin_(make_thorin(opts)), loader_(*thorin_) {
+        loader_.def_cache().enabled = opts.files.size() > 1;
+    }
 
-        IRBuilder irbuilder(thorin, table, extern_globals);
-        for (auto it : data["defs"])
-            irbuilder.reconstruct_def(it);
+    /// Loads the given input files again, after retracting what they contributed to the world so far. Files that define or import
+    /// a name one of them defines are loaded again as well, so that they bind to the new definitions.
+    bool load (const std::set<std::string>& changed) {
+        auto files = changed;
+        add_sharing_files(files);
+        //A file may now define names that it did not before, the files sharing those are loaded again in another round.
+        do {
+            reload(files);
+        } while (add_sharing_files(files));
 
-        if (opts.compute_scope != "") {
-            print_scope_analysis(irbuilder, opts.compute_scope);
+        auto& def_cache = loader_.def_cache();
+        if (def_cache.reused > 0) {
+            std::cerr << "Reused " << def_cache.reused << " identical top level definitions, skipped "
+                      << def_cache.skipped << " of " << def_cache.total << " defs" << std::endl;
+            def_cache.reused = def_cache.skipped = def_cache.total = 0;
         }
+        if (profile_)
+            std::cerr << "Profile: " << profile_->matched() << " of " << profile_->size() << " entries matched a continuation" << std::endl;
+        return failed_.empty();
     }
 
-    for (auto pass : opts.optimizer_passes) {
-        switch (pass) {
-#define MAP(CLASS, ALIAS, PASS) case CLASS: std::cerr << #ALIAS << std::endl; PASS(thorin); break;
-            OptPassesEnum(MAP)
-#undef MAP
+    /// Imports everything the externals reach into the world of thorin, which leaves this world as it is. counts receives the profile counts of the copy.
+    void copy (thorin::Thorin& thorin, ContinuationCounts& counts) {
+        thorin::Importer importer(thorin_->world());
+        for (auto& [name, def] : thorin_->world().externals())
+            importer.import(def);
+        counts = import_counts(counts_, importer);
+        thorin.world_container().swap(importer.world_);
+    }
+
+    const json& checkpoint () const { return checkpoint_; }
+
+private:
+    ProgramOptions& opts_;
+    InputCache& inputs_;
+    Profile* profile_;
+    std::unique_ptr<thorin::Thorin> thorin_;
+    Loader loader_;
+    json checkpoint_;
+    ContinuationCounts counts_;
+    std::set<std::string> seen_;
+    std::set<std::string> failed_;
+    std::map<std::string, ExternalNames> names_;
+
+    /// Adds every file that defines or imports a name that one of files defines. Returns whether any file was added.
+    bool add_sharing_files (std::set<std::string>& files) const {
+        bool added = false;
+        for (bool grown = true; grown;) {
+            grown = false;
+            std::set<std::string> defined;
+            for (auto& filename : files) {
+                auto names = names_.find(filename);
+                if (names != names_.end())
+                    defined.insert(names->second.defined.begin(), names->second.defined.end());
+            }
+            for (auto& [filename, names] : names_) {
+                if (files.count(filename))
+                    continue;
+                bool shares = false;
+                for (auto& name : defined)
+                    shares |= names.defined.count(name) || names.imported.count(name);
+                if (shares) {
+                    files.insert(filename);
+                    grown = added = true;
+                }
+            }
         }
+        return added;
     }
 
-    if (opts.optimizer_passes.empty() && opts.opt_level == 1)
-        thorin.cleanup();
+    /// Retracts every name files define and the imports no other file shares, and loads files in the order they were given in.
+    /// A file that failed to load keeps the world incomplete until it loads again.
+    void reload (const std::set<std::string>& files) {
+        std::set<std::string> retracted;
+        for (auto& filename : files) {
+            auto names = names_.find(filename);
+            if (names == names_.end())
+                continue;
+            retracted.insert(names->second.defined.begin(), names->second.defined.end());
+            retracted.insert(names->second.imported.begin(), names->second.imported.end());
+            names_.erase(names);
+        }
+        //The loader shares one declaration per imported name between all files. No other file uses a name that files define,
+        //see add_sharing_files, but other files may import the same names or define what files import.
+        for (auto& [filename, names] : names_) {
+            for (auto& name : names.imported)
+                retracted.erase(name);
+            for (auto& name : names.defined)
+                retracted.erase(name);
+        }
+        if (!retracted.empty()) {
+            auto& world = thorin_->world();
+            for (auto& name : retracted) {
+                if (auto def = world.externals().lookup(name).value_or(nullptr))
+                    world.make_internal(def);
+            }
+            cleanup_world(*thorin_, counts_);
+            loader_.rebind();
+        }
+
+        for (auto& filename : opts_.files) {
+            if (!files.count(filename))
+                continue;
+            bool first = !seen_.count(filename);
+            ExternalNames names;
+            bool loaded = load_input(loader_, opts_, inputs_, filename, first, checkpoint_, [&] (IRBuilder& irbuilder) {
+                if (first && opts_.compute_scope != "")
+                    print_scope_analysis(irbuilder, opts_.compute_scope);
+                if (profile_)
+                    profile_->attach(irbuilder, filename, opts_.files.size() > 1, counts_);
+            }, &names);
+            seen_.insert(filename);
+            names_[filename] = std::move(names);
+            if (loaded)
+                failed_.erase(filename);
+            else
+                failed_.insert(filename);
+        }
+    }
+};
+
+/// Loads the inputs, or copies warm in --watch mode, optimizes the world and emits the requested outputs.
+static int compile (ProgramOptions opts, InputCache& inputs, TimeReport& timing, Profile* profile, WarmWorld* warm = nullptr) {
+    if (opts.module_name == "") {
+        auto data = inputs.get(opts.files[0]);
+        if (!data)
+            return EXIT_FAILURE;
+        opts.module_name = (*data)["module"].get<std::string>();
+    }
+
+    auto thorin = make_thorin(opts);
+    PassContext context { profile, {}, opts.heap_to_stack_limit };
+    json checkpoint;
+    DefNames def_names;
+
+    if (warm) {
+        //The names of the input defs are not tracked across reloads, --analyze reports Thorin's names in --watch mode.
+        warm->copy(*thorin, context.counts);
+        thorin->world().set(opts.log_level);
+        thorin->world().set(std::make_shared<thorin::Stream>(std::cerr));
+        checkpoint = warm->checkpoint();
+    } else {
+        Loader loader(*thorin);
+        auto& def_cache = loader.def_cache();
+        def_cache.enabled = opts.files.size() > 1;
+
+        for (auto filename : opts.files) {
+            bool loaded = load_input(loader, opts, inputs, filename, true, checkpoint, [&] (IRBuilder& irbuilder) {
+                if (opts.compute_scope != "")
+                    print_scope_analysis(irbuilder, opts.compute_scope);
+                if (opts.analyze != "")
+                    add_def_names(def_names, irbuilder);
+                if (profile)
+                    profile->attach(irbuilder, filename, opts.files.size() > 1, context.counts);
+            });
+            if (!loaded)
+                return EXIT_FAILURE;
+        }
+
+        if (def_cache.reused > 0) {
+            std::cerr << "Reused " << def_cache.reused << " identical top level definitions, skipped "
+                      << def_cache.skipped << " of " << def_cache.total << " defs" << std::endl;
+        }
+
+        if (profile)
+            std::cerr << "Profile: " << profile->matched() << " of " << profile->size() << " entries matched a continuation" << std::endl;
+    }
+
+    if (opts.export_list != "" && !internalize(*thorin, opts.export_list, context.counts))
+        return EXIT_FAILURE;
+
+    if (opts.resume_from != "" && checkpoint.is_object() && checkpoint.value("pe_done", false))
+        thorin->world().mark_pe_done();
+
+    timing.load += timing.lap();
+
+    if (opts.analyze != "") {
+        std::vector<std::string> entries;
+        if (opts.analyze != "all") {
+            std::stringstream list(opts.analyze);
+            for (std::string name; std::getline(list, name, ',');) {
+                if (name != "")
+                    entries.push_back(name);
+            }
+        }
+        std::cout << analyze_scopes(thorin->world(), entries, def_names, opts.jobs).dump(2) << std::endl;
+        //The analysis is reported on its own and not counted as optimization time.
+        timing.lap();
+    }
+    timing.first_pass = timing.since_start();
+
+    std::vector<ModuleFormat> cpu_formats;
+    if (opts.emit_llvm)
+        cpu_formats.push_back(ModuleFormat::Text);
+    if (opts.emit_bc)
+        cpu_formats.push_back(ModuleFormat::Bitcode);
+    if (opts.emit_obj)
+        cpu_formats.push_back(ModuleFormat::Object);
+    bool runs_opt = opts.opt_level > 1 || opts.emit_c || !cpu_formats.empty();
+
+    //Checkpoints, the size budget, profiles and the pe cache need an explicit pipeline,
+    //so the normal pass chain stands in for thorin.opt() whenever that would run.
+    auto pipeline = opts.optimizer_passes;
+    if (pipeline.empty() && runs_opt && (opts.checkpoint_after != "" || opts.resume_from != "" || opts.size_budget > 0 || opts.profile != ""
+                             || opts.pe_cache != "")) {
+        pipeline.assign(std::begin(default_passes), std::end(default_passes));
+        //Hot call sites are inlined first, so partial evaluation specializes their bodies along with their callers.
+        if (opts.profile != "")
+            pipeline.insert(std::find(pipeline.begin(), pipeline.end(), Lower2CFF), PGO_Inline);
+    }
+
+    size_t first_pass = 0;
+    if (opts.resume_from != "") {
+        if (checkpoint.is_null()) {
+            std::cerr << opts.resume_from << " is not a checkpoint" << std::endl;
+            return EXIT_FAILURE;
+        }
+        //Without any pass to run there is nothing to continue, the checkpoint is emitted as it is.
+        auto& done = checkpoint["passes"];
+        for (; !pipeline.empty() && first_pass < done.size(); ++first_pass) {
+            if (first_pass >= pipeline.size() || done[first_pass] != pass_name(pipeline[first_pass])) {
+                std::cerr << "Checkpoint " << opts.resume_from << " was taken with a different pass pipeline" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    bool checkpoint_written = false;
+    IncrementalVerifier verifier(opts.verify_sample);
+    for (size_t i = first_pass; i < pipeline.size(); ++i) {
+        if (opts.verify_each)
+            verifier.before(thorin->world(), world_generation);
+        auto pass_start = TimeReport::Clock::now();
+        if (opts.pe_cache != "" && (pipeline[i] == PE || pipeline[i] == Lower2CFF)) {
+            if (!run_cached_pass(thorin, opts, pipeline[i], context))
+                return EXIT_FAILURE;
+        } else if (opts.size_budget > 0 && (pipeline[i] == Inliner || pipeline[i] == PE || pipeline[i] == Lower2CFF)) {
+            run_budgeted_pass(thorin, opts, pipeline[i], context);
+        } else {
+            run_pass(*thorin, pipeline[i], context);
+        }
+        timing.pass_times.emplace_back(pass_name(pipeline[i]), std::chrono::duration<double>(TimeReport::Clock::now() - pass_start).count());
+        if (opts.verify_each && !verifier.after(thorin->world(), world_generation, pass_name(pipeline[i])))
+            return EXIT_FAILURE;
+        if (!checkpoint_written && opts.checkpoint_after == pass_name(pipeline[i])) {
+            if (!write_checkpoint(*thorin, opts, pipeline, i + 1))
+                return EXIT_FAILURE;
+            checkpoint_written = true;
+        }
+    }
+    if (opts.verify_each) {
+        std::cerr << "Verified " << verifier.checked << " of " << verifier.total << " defs after passes ("
+                  << verifier.full_verifies << " full verifications)" << std::endl;
+    }
+    if (opts.checkpoint_after != "" && !checkpoint_written)
+        std::cerr << "Warning: pass " << opts.checkpoint_after << " is not part of the pipeline, no checkpoint was written" << std::endl;
+
+    if (pipeline.empty() && opts.opt_level == 1)
+        thorin->cleanup();
     if (opts.emit_c_int) {
         auto name = opts.module_name + ".h";
         std::ofstream file(name);
@@ -361,47 +1397,239 @@ int main (int argc, char** argv) {
             std::cerr << "cannot open '" << name << "' for writing" << std::endl;
         else {
             thorin::Stream stream(file);
-            thorin::c::emit_c_int(thorin, stream);
+            thorin::c::emit_c_int(*thorin, stream);
         }
     }
 
-    if (opts.optimizer_passes.empty() && (opts.opt_level > 1 || opts.emit_c || opts.emit_llvm))
-        thorin.opt();
+    if (pipeline.empty() && runs_opt)
+        thorin->opt();
+    timing.passes = timing.lap();
     if (opts.emit_thorin)
-        thorin.world().dump();
+        thorin->world().dump();
 
-    if (opts.emit_json || opts.emit_c || opts.emit_llvm) {
+    if (opts.emit_json || opts.emit_c || !cpu_formats.empty()) {
+        for (auto& [ext, target] : opts.outputs)
+            expect_output(target);
+        //Outputs routed with --out keep their target as is, all others are named after the module.
+        auto output_name = [&] (const std::string& ext, Compression compression) {
+            auto routed = opts.outputs.find(ext.substr(1));
+            if (routed != opts.outputs.end())
+                return routed->second;
+            return opts.module_name + ext + compression_extension(compression);
+        };
         auto emit_to_file = [&] (thorin::CodeGen& cg) {
-            auto name = opts.module_name + cg.file_ext();
-            std::ofstream file(name);
+            //Only the textual IR is worth compressing, C and device code is handed to other compilers as is.
+            auto compression = Compression::None;
+            std::string ext = cg.file_ext();
+            if (ext == ".ll" || ext == ".json")
+                compression = opts.compression;
+            auto name = output_name(ext, compression);
+            auto file = open_output(name, compression);
             if (!file)
                 std::cerr << "cannot open '" << name << "' for writing" << std::endl;
             else
-                cg.emit_stream(file);
+                cg.emit_stream(*file);
         };
         if (opts.emit_json) {
-            thorin::json::CodeGen cg(thorin, opts.debug, opts.host_triple, opts.host_cpu, opts.host_attr);
+            thorin::json::CodeGen cg(*thorin, opts.debug, opts.host_triple, opts.host_cpu, opts.host_attr);
             emit_to_file(cg);
         }
-        if (opts.emit_c || opts.emit_llvm) {
-            thorin::DeviceBackends backends(thorin.world(), opts.opt_level, opts.debug, opts.hls_flags);
+        if (opts.emit_c || !cpu_formats.empty()) {
+            //Setting up the device backends costs more than compiling a small module, so it only happens for worlds with device code.
+            std::unique_ptr<thorin::DeviceBackends> backends;
+            if (has_device_code(thorin->world()))
+                backends = std::make_unique<thorin::DeviceBackends>(thorin->world(), opts.opt_level, opts.debug, opts.hls_flags);
             if (opts.emit_c) {
                 thorin::Cont2Config kernel_configs;
-                thorin::c::CodeGen cg(thorin, kernel_configs, thorin::c::Lang::C99, opts.debug, opts.hls_flags);
+                thorin::c::CodeGen cg(*thorin, kernel_configs, thorin::c::Lang::C99, opts.debug, opts.hls_flags);
                 emit_to_file(cg);
             }
-            if (opts.emit_llvm) {
-                thorin::llvm::CPUCodeGen cg(thorin, opts.opt_level, opts.debug, opts.host_triple, opts.host_cpu, opts.host_attr);
+            if (!cpu_formats.empty() && opts.host_cpu.find(',') != std::string::npos) {
+                std::vector<std::string> cpus;
+                std::stringstream list(opts.host_cpu);
+                for (std::string cpu; std::getline(list, cpu, ',');) {
+                    if (cpu != "")
+                        cpus.push_back(cpu);
+                }
+                if (!emit_multi_isa(*thorin, cpus, opts.opt_level, opts.debug, opts.host_triple, opts.host_attr, opts.module_name,
+                                    cpu_formats, opts.compression, opts.jobs))
+                    return EXIT_FAILURE;
+            } else if (opts.emit_bc || opts.emit_obj) {
+                //Bitcode and objects are written straight from the in-memory module, textual IR comes along for free.
+                thorin::llvm::CPUCodeGen cg(*thorin, opts.opt_level, opts.debug, opts.host_triple, opts.host_cpu, opts.host_attr);
+                auto [context, module] = cg.emit_module();
+                for (auto format : cpu_formats) {
+                    auto compression = format == ModuleFormat::Text ? opts.compression : Compression::None;
+                    auto name = output_name(module_format_extension(format), compression);
+                    auto file = open_output(name, compression);
+                    if (!file) {
+                        std::cerr << "cannot open '" << name << "' for writing" << std::endl;
+                        continue;
+                    }
+                    if (!write_module(*module, *file, format, opts.opt_level, opts.host_cpu, opts.host_attr))
+                        return EXIT_FAILURE;
+                }
+            } else if (opts.emit_llvm) {
+                thorin::llvm::CPUCodeGen cg(*thorin, opts.opt_level, opts.debug, opts.host_triple, opts.host_cpu, opts.host_attr);
                 emit_to_file(cg);
             }
-            for (auto& cg : backends.cgs) {
-                if (cg) {
-                    std::cerr << "AnyOpt Codegen " << cg->file_ext() << std::endl;
-                    emit_to_file(*cg);
+            if (backends) {
+                for (auto& cg : backends->cgs) {
+                    if (cg) {
+                        std::cerr << "AnyOpt Codegen " << cg->file_ext() << std::endl;
+                        emit_to_file(*cg);
+                    }
                 }
             }
         }
     }
+    timing.codegen = timing.lap();
+
+    if (opts.fast_exit && !opts.watch) {
+        //All outputs are closed by now. What is left is freeing the world, the loader's maps and the parsed inputs,
+        //which the kernel does much faster by dropping the address space.
+        if (opts.time_report != "" && !write_time_report(opts.time_report, timing))
+            _exit(EXIT_FAILURE);
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
+        _exit(EXIT_SUCCESS);
+    }
 
     return 0;
 }
+
+#ifdef __linux__
+/// Rebuilds whenever one of the input files is written or replaced. Only the changed files are loaded again, see WarmWorld.
+static int watch (ProgramOptions opts, InputCache& inputs, Profile* profile) {
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        perror("inotify_init1");
+        return EXIT_FAILURE;
+    }
+
+    //Editors and build tools often replace files instead of writing them, so the directories are watched.
+    std::map<int, std::string> directories;
+    std::set<std::string> watched;
+    for (auto& filename : opts.files) {
+        auto slash = filename.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+        int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd < 0) {
+            perror(directory.c_str());
+            return EXIT_FAILURE;
+        }
+        directories[wd] = slash == std::string::npos ? "" : directory;
+        watched.insert(filename);
+    }
+
+    WarmWorld warm(opts, inputs, profile);
+    std::set<std::string> changed(opts.files.begin(), opts.files.end());
+    {
+        TimeReport timing;
+        if (warm.load(changed)) {
+            timing.load = timing.lap();
+            compile(opts, inputs, timing, profile, &warm);
+        }
+    }
+    std::cerr << "Watching " << opts.files.size() << " input files" << std::endl;
+
+    alignas(struct inotify_event) char buffer[1 << 16];
+    while (true) {
+        changed.clear();
+        int timeout = -1;
+        //After the first relevant event, wait until the files have been quiet for a moment, a producer usually writes several of them.
+        while (true) {
+            struct pollfd pfd = { fd, POLLIN, 0 };
+            int ready = poll(&pfd, 1, timeout);
+            if (ready < 0) {
+                perror("poll");
+                return EXIT_FAILURE;
+            }
+            if (ready == 0)
+                break;
+
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0) {
+                perror("read");
+                return EXIT_FAILURE;
+            }
+            for (char* ptr = buffer; ptr < buffer + length;) {
+                auto event = reinterpret_cast<struct inotify_event*>(ptr);
+                if (event->len > 0 && watched.count(directories[event->wd] + event->name))
+                    changed.insert(directories[event->wd] + event->name);
+                ptr += sizeof(struct inotify_event) + event->len;
+            }
+            if (!changed.empty())
+                timeout = 50;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        TimeReport timing;
+        int result = EXIT_FAILURE;
+        if (warm.load(changed)) {
+            //Reloading the changed files counts as loading, copying the warm world is added by compile.
+            timing.load = timing.lap();
+            result = compile(opts, inputs, timing, profile, &warm);
+        }
+        if (result == EXIT_SUCCESS && opts.time_report != "")
+            write_time_report(opts.time_report, timing);
+        std::cerr << (result == EXIT_SUCCESS ? "Rebuilt" : "Rebuild failed") << " after "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s" << std::endl;
+    }
+}
+#else
+static int watch (ProgramOptions, InputCache&, Profile*) {
+    std::cerr << "--watch is only supported on Linux" << std::endl;
+    return EXIT_FAILURE;
+}
+#endif
+
+int main (int argc, char** argv) {
+    //Before any file is opened, see connect_jobserver.
+    connect_jobserver();
+
+    ProgramOptions opts;
+    if (!opts.parse(argc, argv))
+        return EXIT_FAILURE;
+    if (opts.exit)
+        return EXIT_SUCCESS;
+
+    if (opts.resume_from != "") {
+        if (!opts.files.empty()) {
+            std::cerr << "a checkpoint cannot be combined with other input files" << std::endl;
+            return EXIT_FAILURE;
+        }
+        opts.files.push_back(opts.resume_from);
+    }
+
+    if (opts.files.empty()) {
+        std::cerr << "no input files" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Profile profile;
+    if (opts.profile != "") {
+        if (!profile.load(opts.profile))
+            return EXIT_FAILURE;
+        profile.hot_fraction = opts.profile_hot;
+    }
+    auto given_profile = opts.profile != "" ? &profile : nullptr;
+
+    InputCache inputs;
+    if (opts.watch) {
+        if (std::find(opts.files.begin(), opts.files.end(), "-") != opts.files.end()) {
+            std::cerr << "--watch cannot watch stdin" << std::endl;
+            return EXIT_FAILURE;
+        }
+        return watch(opts, inputs, given_profile);
+    }
+
+    TimeReport timing;
+    int result = compile(opts, inputs, timing, given_profile);
+    //Everything compile() created is destroyed by now, see --fast-exit.
+    timing.teardown = timing.lap();
+    if (result == EXIT_SUCCESS && opts.time_report != "" && !write_time_report(opts.time_report, timing))
+        return EXIT_FAILURE;
+    return result;
+}
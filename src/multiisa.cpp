@@ -0,0 +1,234 @@
+#include "anyopt/multiisa.h"
+#include "anyopt/parallel.h"
+#include "anyopt/stream.h"
+
+#include<algorithm>
+#include<cctype>
+#include<fstream>
+#include<iostream>
+#include<memory>
+#include<tuple>
+
+#ifdef ENABLE_LLVM
+#include<thorin/be/llvm/cpu.h>
+
+#include<llvm/IR/LLVMContext.h>
+#include<llvm/IR/Module.h>
+#endif
+
+namespace anyopt {
+
+#ifdef ENABLE_LLVM
+/// CPUs the dispatcher knows, with the features (as understood by __builtin_cpu_supports) that have to be present to run code built for them.
+static const std::pair<const char*, std::vector<const char*>> cpu_features[] = {
+    { "generic", {} },
+    { "x86-64", {} },
+    { "x86-64-v2", { "sse4.2", "popcnt" } },
+    { "nehalem", { "sse4.2", "popcnt" } },
+    { "westmere", { "sse4.2", "popcnt" } },
+    { "sandybridge", { "avx" } },
+    { "ivybridge", { "avx" } },
+    { "x86-64-v3", { "avx2", "fma", "bmi2" } },
+    { "haswell", { "avx2", "fma", "bmi2" } },
+    { "broadwell", { "avx2", "fma", "bmi2" } },
+    { "skylake", { "avx2", "fma", "bmi2" } },
+    { "znver1", { "avx2", "fma", "bmi2" } },
+    { "znver2", { "avx2", "fma", "bmi2" } },
+    { "znver3", { "avx2", "fma", "bmi2" } },
+    { "x86-64-v4", { "avx512f", "avx512bw", "avx512dq", "avx512vl" } },
+    { "skylake-avx512", { "avx512f", "avx512bw", "avx512dq", "avx512vl" } },
+    { "cascadelake", { "avx512f", "avx512bw", "avx512dq", "avx512vl" } },
+    { "icelake-server", { "avx512f", "avx512bw", "avx512dq", "avx512vl", "avx512vbmi2" } },
+    { "sapphirerapids", { "avx512f", "avx512bw", "avx512dq", "avx512vl", "avx512vbmi2" } },
+    { "znver4", { "avx512f", "avx512bw", "avx512dq", "avx512vl", "avx512vbmi2" } },
+};
+
+static const std::vector<const char*>* find_features (const std::string& cpu) {
+    for (auto& [name, features] : cpu_features) {
+        if (cpu == name)
+            return &features;
+    }
+    return nullptr;
+}
+
+/// Suffix of the variant symbols, cpu names like x86-64-v3 are no valid assembler identifiers.
+static std::string symbol_suffix (const std::string& cpu) {
+    std::string suffix = "_";
+    for (auto c : cpu)
+        suffix += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    return suffix;
+}
+
+/// C spelling of an LLVM parameter or return type, empty if C has no direct equivalent.
+static std::string c_type (llvm::Type* type) {
+    if (type->isVoidTy())
+        return "void";
+    if (type->isFloatTy())
+        return "float";
+    if (type->isDoubleTy())
+        return "double";
+    if (type->isPointerTy())
+        return "void*";
+    if (type->isIntegerTy(1))
+        return "_Bool";
+    for (unsigned bits : { 8, 16, 32, 64 }) {
+        if (type->isIntegerTy(bits))
+            return "int" + std::to_string(bits) + "_t";
+    }
+    return "";
+}
+
+/// C declaration of the function name with the signature of function. Signatures C cannot spell (vectors, aggregates) are declared
+/// without a prototype, which is enough to define the ifunc and to take the variants' addresses.
+static std::string c_declaration (llvm::Function& function, const std::string& name) {
+    auto fn_type = function.getFunctionType();
+    auto result = c_type(fn_type->getReturnType());
+    std::string params;
+    for (auto param : fn_type->params()) {
+        auto param_type = c_type(param);
+        if (param_type == "" || param_type == "void")
+            return (result == "" ? "void" : result) + " " + name + "()";
+        params += (params.empty() ? "" : ", ") + param_type;
+    }
+    if (result == "")
+        return "void " + name + "()";
+    if (fn_type->isVarArg())
+        params += params.empty() ? "..." : ", ...";
+    return result + " " + name + "(" + (params.empty() ? "void" : params) + ")";
+}
+
+/// A defined external function of the module, with its C declaration written for the name placeholder $.
+struct DispatchedFunction {
+    std::string name;
+    std::string declaration;
+
+    std::string declare (const std::string& symbol) const {
+        auto result = declaration;
+        result.replace(result.find('$'), 1, symbol);
+        return result;
+    }
+    bool operator< (const DispatchedFunction& other) const { return name < other.name; }
+};
+
+static bool write_dispatch (const std::string& filename, const std::vector<std::string>& cpus, const std::vector<DispatchedFunction>& functions) {
+    std::ofstream file(filename);
+    if (!file) {
+        std::cerr << "cannot open '" << filename << "' for writing" << std::endl;
+        return false;
+    }
+
+    file << "/* Generated by anyopt: selects one of the " << cpus.size() << " variants of this module when it is loaded. */\n\n";
+    file << "#include <stdint.h>\n\n";
+    for (size_t f = 0; f < functions.size(); ++f) {
+        auto& name = functions[f].name;
+        for (size_t v = 0; v < cpus.size(); ++v)
+            file << "extern " << functions[f].declare(name + symbol_suffix(cpus[v])) << ";\n";
+
+        file << "static void* anyopt_resolve_" << f << "(void) {\n";
+        file << "    __builtin_cpu_init();\n";
+        for (size_t v = cpus.size() - 1; v > 0; --v) {
+            auto features = find_features(cpus[v]);
+            if (features->empty()) {
+                file << "    return (void*) " << name << symbol_suffix(cpus[v]) << ";\n";
+                break;
+            }
+            file << "    if (";
+            for (size_t i = 0; i < features->size(); ++i)
+                file << (i > 0 ? " && " : "") << "__builtin_cpu_supports(\"" << (*features)[i] << "\")";
+            file << ")\n        return (void*) " << name << symbol_suffix(cpus[v]) << ";\n";
+        }
+        file << "    return (void*) " << name << symbol_suffix(cpus[0]) << ";\n";
+        file << "}\n";
+        file << functions[f].declare(name) << " __attribute__((ifunc(\"anyopt_resolve_" << f << "\")));\n\n";
+    }
+    return bool(file);
+}
+
+bool emit_multi_isa (thorin::Thorin& thorin, const std::vector<std::string>& cpus, int opt_level, bool debug,
+                     const std::string& host_triple, const std::string& host_attr, const std::string& module_name,
+                     const std::vector<ModuleFormat>& formats, Compression compression, size_t jobs) {
+    for (auto& cpu : cpus) {
+        if (!find_features(cpu)) {
+            std::cerr << "Don't know how to detect cpu " << cpu << " at runtime, known cpus are:";
+            for (auto& [name, _] : cpu_features)
+                std::cerr << " " << name;
+            std::cerr << std::endl;
+            return false;
+        }
+    }
+
+    struct Variant {
+        std::string triple, cpu, attr;
+        std::unique_ptr<::llvm::LLVMContext> context;
+        std::unique_ptr<::llvm::Module> module;
+        std::vector<DispatchedFunction> functions;
+        bool written = false;
+    };
+    std::vector<Variant> variants(cpus.size());
+
+    //The backends read the world and fill state that is shared through it, so the modules are emitted one after another.
+    //LLVM's target registry is not safe to initialize concurrently either.
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        auto& variant = variants[i];
+        variant.triple = host_triple;
+        variant.cpu = cpus[i];
+        variant.attr = host_attr;
+        thorin::llvm::CPUCodeGen cg(thorin, opt_level, debug, variant.triple, variant.cpu, variant.attr);
+        std::tie(variant.context, variant.module) = cg.emit_module();
+    }
+
+    //From here on every variant only touches its own LLVMContext, so they are optimized and written side by side.
+    parallel_for(variants.size(), jobs, [&] (size_t i) {
+        auto& variant = variants[i];
+        auto& module = variant.module;
+
+        for (auto& function : *module) {
+            if (function.isDeclaration() || !function.hasExternalLinkage())
+                continue;
+            variant.functions.push_back({ function.getName().str(), c_declaration(function, "$") });
+            function.setName(function.getName() + symbol_suffix(variant.cpu));
+        }
+        if (i > 0) {
+            //The first variant owns the data, the others refer to it.
+            for (auto& global : module->globals()) {
+                if (global.isDeclaration() || !global.hasExternalLinkage())
+                    continue;
+                global.setInitializer(nullptr);
+                global.setComdat(nullptr);
+            }
+        }
+
+        variant.written = true;
+        for (auto format : formats) {
+            auto name = module_name + "." + variant.cpu + module_format_extension(format);
+            if (format == ModuleFormat::Text)
+                name += compression_extension(compression);
+            auto file = open_output(name, format == ModuleFormat::Text ? compression : Compression::None);
+            if (!file) {
+                std::cerr << "cannot open '" << name << "' for writing" << std::endl;
+                variant.written = false;
+            } else {
+                variant.written &= write_module(*module, *file, format, opt_level, variant.cpu, variant.attr);
+            }
+        }
+        module.reset();
+        variant.context.reset();
+    });
+
+    if (!std::all_of(variants.begin(), variants.end(), [] (const Variant& variant) { return variant.written; }))
+        return false;
+
+    auto functions = variants[0].functions;
+    std::sort(functions.begin(), functions.end());
+    return write_dispatch(module_name + ".dispatch.c", cpus, functions);
+}
+#else
+bool emit_multi_isa (thorin::Thorin&, const std::vector<std::string>&, int, bool,
+                     const std::string&, const std::string&, const std::string&,
+                     const std::vector<ModuleFormat>&, Compression, size_t) {
+    std::cerr << "anyopt was built without LLVM support, cannot emit cpu variants" << std::endl;
+    return false;
+}
+#endif
+
+}
@@ -0,0 +1,146 @@
+#include "anyopt/parallel.h"
+
+#include<atomic>
+#include<cerrno>
+#include<cstdlib>
+#include<cstring>
+#include<iostream>
+#include<sstream>
+#include<string>
+#include<thread>
+#include<vector>
+
+#include<fcntl.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+namespace anyopt {
+
+/// Whether fd is open and a fifo or a pipe, as a jobserver's descriptors are.
+static bool is_fifo (int fd) {
+    struct stat info;
+    return fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+/// Client of the GNU make jobserver named in MAKEFLAGS. Tokens are only ever taken without blocking,
+/// work that finds none is done by the threads that are already running.
+class Jobserver {
+public:
+    Jobserver() {
+        auto makeflags = std::getenv("MAKEFLAGS");
+        if (!makeflags)
+            return;
+
+        //Only the last jobserver option counts, make appends its own to the ones it inherited.
+        std::string auth;
+        std::stringstream flags(makeflags);
+        for (std::string flag; flags >> flag;) {
+            for (auto option : { "--jobserver-auth=", "--jobserver-fds=" }) {
+                if (flag.compare(0, strlen(option), option) == 0)
+                    auth = flag.substr(strlen(option));
+            }
+        }
+        if (auth == "")
+            return;
+
+        if (auth.compare(0, 5, "fifo:") == 0) {
+            read_fd_ = write_fd_ = open(auth.c_str() + 5, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+            if (read_fd_ < 0) {
+                std::cerr << "Warning: cannot open the jobserver fifo " << auth.substr(5) << ", falling back to -j" << std::endl;
+            } else if (!is_fifo(read_fd_)) {
+                std::cerr << "Warning: the jobserver " << auth.substr(5) << " is not a fifo, falling back to -j" << std::endl;
+                close(read_fd_);
+                read_fd_ = write_fd_ = -1;
+            }
+            return;
+        }
+
+        int read_fd, write_fd;
+        char separator;
+        std::stringstream fds(auth);
+        if (!(fds >> read_fd >> separator >> write_fd) || separator != ',')
+            return;
+        //make hands the descriptors only to recipes it knows to be recursive. Otherwise the numbers are free, or taken by
+        //something else this process inherited, which is why anything but a pipe is ignored.
+        if (!is_fifo(read_fd) || !is_fifo(write_fd)) {
+            std::cerr << "Warning: the jobserver is not available to anyopt (mark the recipe with +), falling back to -j" << std::endl;
+            return;
+        }
+        //The pipe is shared with make and every other job, so it is reopened instead of being switched to non-blocking mode.
+        read_fd_ = open(("/proc/self/fd/" + std::to_string(read_fd)).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        write_fd_ = write_fd;
+        if (read_fd_ < 0)
+            std::cerr << "Warning: cannot read from the jobserver pipe without blocking, falling back to -j" << std::endl;
+    }
+
+    bool active () const { return read_fd_ >= 0; }
+
+    bool try_acquire (char& token) {
+        ssize_t count;
+        do {
+            count = read(read_fd_, &token, 1);
+        } while (count < 0 && errno == EINTR);
+        return count == 1;
+    }
+
+    void release (char token) {
+        while (write(write_fd_, &token, 1) < 0 && errno == EINTR);
+    }
+
+private:
+    int read_fd_ = -1;
+    int write_fd_ = -1;
+};
+
+static Jobserver& jobserver () {
+    static Jobserver jobserver;
+    return jobserver;
+}
+
+void connect_jobserver () {
+    jobserver();
+}
+
+size_t default_jobs () {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void parallel_for (size_t n, size_t jobs, const std::function<void(size_t)>& body) {
+    std::atomic<size_t> next = 0;
+    auto worker = [&] () {
+        for (size_t i = next++; i < n; i = next++)
+            body(i);
+    };
+
+    size_t extra = std::min(jobs, n);
+    extra = extra > 0 ? extra - 1 : 0;
+
+    std::vector<std::thread> threads;
+    if (!jobserver().active()) {
+        for (size_t i = 0; i < extra; ++i)
+            threads.emplace_back(worker);
+        worker();
+    } else {
+        //The process itself holds one implicit token, every extra worker needs one more. Tokens that free up later
+        //are picked up between work items.
+        auto spawn = [&] () {
+            char token;
+            if (threads.size() >= extra || !jobserver().try_acquire(token))
+                return false;
+            threads.emplace_back([&, token] () {
+                worker();
+                jobserver().release(token);
+            });
+            return true;
+        };
+        while (spawn());
+        for (size_t i = next++; i < n; i = next++) {
+            body(i);
+            spawn();
+        }
+    }
+    for (auto& thread : threads)
+        thread.join();
+}
+
+}
@@ -0,0 +1,126 @@
+#include "anyopt/profile.h"
+#include "anyopt/stream.h"
+
+#include<thorin/analyses/scope.h>
+#include<thorin/transform/mangle.h>
+
+#include<iostream>
+
+namespace anyopt {
+
+/// Callees with larger scopes are never inlined, however hot the call site is.
+static const size_t MaxInlineSize = 512;
+
+bool Profile::load(const std::string& filename) {
+    auto file = open_input(filename);
+    if (!file) {
+        std::cerr << "cannot open '" << filename << "' for reading" << std::endl;
+        return false;
+    }
+    json data = json::parse(*file, nullptr, false);
+    if (!data.is_object()) {
+        std::cerr << filename << " is not a profile, expected an object that maps names to counts" << std::endl;
+        return false;
+    }
+
+    for (auto& [name, count] : data.items()) {
+        if (!count.is_number_unsigned()) {
+            std::cerr << "Warning: ignoring the count of " << name << " in " << filename << ", it is not an unsigned number" << std::endl;
+            continue;
+        }
+        counts_[name] = count.get<uint64_t>();
+        max_count_ = std::max(max_count_, counts_[name]);
+    }
+    return true;
+}
+
+void Profile::attach(IRBuilder& irbuilder, const std::string& filename, bool several_files, ContinuationCounts& counts) {
+    for (auto it : irbuilder) {
+        auto continuation = it.second->isa_nom<thorin::Continuation>();
+        if (!continuation)
+            continue;
+
+        //Externals are also found by their external name, plain def names only if they cannot be ambiguous.
+        std::vector<std::string> keys;
+        if (continuation->is_external())
+            keys.push_back(continuation->name());
+        keys.push_back(filename + ":" + it.first);
+        if (!several_files)
+            keys.push_back(it.first);
+        for (auto& key : keys) {
+            auto count = counts_.find(key);
+            if (count == counts_.end())
+                continue;
+            counts[continuation] = count->second;
+            matched_.insert(key);
+            break;
+        }
+    }
+}
+
+ContinuationCounts import_counts(const ContinuationCounts& counts, const thorin::Importer& importer) {
+    ContinuationCounts imported;
+    for (auto [continuation, count] : counts) {
+        auto copy = importer.def_old2new_.find(continuation);
+        if (copy == importer.def_old2new_.end())
+            continue;
+        if (auto nominal = copy->second->isa_nom<thorin::Continuation>())
+            imported[nominal] = count;
+    }
+    return imported;
+}
+
+void pgo_inline(thorin::Thorin& thorin, const Profile* profile, const ContinuationCounts& counts) {
+    if (!profile || profile->empty()) {
+        std::cerr << "  no profile given, nothing to inline" << std::endl;
+        return;
+    }
+    if (counts.empty()) {
+        std::cerr << "  no continuation of this world has a count, nothing to inline" << std::endl;
+        return;
+    }
+    uint64_t hot = std::max<uint64_t>(1, profile->max_count() * profile->hot_fraction);
+    auto count_of = [&] (const thorin::Continuation* continuation) -> uint64_t {
+        auto count = counts.find(continuation);
+        return count != counts.end() ? count->second : 0;
+    };
+
+    size_t inlined = 0, cold = 0, too_large = 0;
+    //Only the call sites that exist up front are considered, the copies inlining makes have no count of their own.
+    for (auto caller : thorin.world().copy_continuations()) {
+        if (!caller->has_body())
+            continue;
+        auto callee = caller->body()->callee()->isa_nom<thorin::Continuation>();
+        //Jumps to basic blocks (loop headers, join points) are not calls, inlining them would only duplicate hot blocks.
+        if (!callee || !callee->has_body() || callee == caller || !callee->is_returning())
+            continue;
+
+        //A call runs as often as the block it ends, the callee's own count sums up all of its call sites.
+        auto count = count_of(caller);
+        if (count == 0)
+            count = count_of(callee);
+        if (count < hot) {
+            cold++;
+            continue;
+        }
+
+        thorin::Scope scope(callee);
+        if (scope.contains(caller))
+            continue;
+        if (scope.defs().size() > MaxInlineSize) {
+            std::cerr << "  not inlining " << callee->unique_name() << " into " << caller->unique_name() << " (" << count
+                      << " executions): " << scope.defs().size() << " defs" << std::endl;
+            too_large++;
+            continue;
+        }
+
+        caller->jump(thorin::drop(scope, caller->body()->args()), {});
+        std::cerr << "  inlined " << callee->unique_name() << " into " << caller->unique_name() << " (" << count << " executions)" << std::endl;
+        inlined++;
+    }
+
+    std::cerr << "  inlined " << inlined << " hot call sites, left " << cold << " cold ones alone, "
+              << too_large << " callees were too large" << std::endl;
+}
+
+}
@@ -0,0 +1,93 @@
+#include "anyopt/promote_globals.h"
+
+#include<iostream>
+#include<utility>
+#include<vector>
+
+namespace anyopt {
+
+typedef std::vector<std::pair<const thorin::Load*, std::vector<const thorin::Def*>>> Loads;
+
+/// Collects the loads reading through ptr, each with the lea indices on its way. Returns false if the address is used in any other way.
+static bool collect_loads (const thorin::Def* ptr, std::vector<const thorin::Def*>& path, Loads& loads) {
+    for (auto& use : ptr->uses()) {
+        if (auto load = use->isa<thorin::Load>(); load && use.index() == 1) {
+            loads.emplace_back(load, path);
+        } else if (auto lea = use->isa<thorin::LEA>(); lea && use.index() == 0) {
+            path.push_back(lea->index());
+            bool only_loads = collect_loads(lea, path, loads);
+            path.pop_back();
+            if (!only_loads)
+                return false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_constant (const thorin::Def* def) {
+    if (def->isa<thorin::Literal>())
+        return true;
+    if (def->isa<thorin::DefiniteArray>() || def->isa<thorin::StructAgg>() || def->isa<thorin::Tuple>() || def->isa<thorin::Vector>()) {
+        for (auto op : def->ops()) {
+            if (!is_constant(op))
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool promote_const_globals(thorin::Thorin& thorin) {
+    auto& world = thorin.world();
+
+    std::vector<const thorin::Global*> candidates;
+    for (auto def : world.defs()) {
+        //External globals may be written by other modules, and a bottom initializer means the definition lives elsewhere.
+        auto global = def->isa<thorin::Global>();
+        if (global && global->is_mutable() && !global->is_external() && !global->init()->isa<thorin::Bottom>())
+            candidates.push_back(global);
+    }
+
+    size_t promoted = 0, folded = 0;
+    for (auto global : candidates) {
+        Loads loads;
+        std::vector<const thorin::Def*> path;
+        if (!collect_loads(global, path, loads))
+            continue;
+
+        size_t global_folded = 0;
+        if (is_constant(global->init())) {
+            for (auto& [load, indices] : loads) {
+                //Extracting constant indices from a constant aggregate folds right away.
+                auto value = global->init();
+                bool constant_indices = true;
+                for (auto index : indices) {
+                    if (!(constant_indices = index->isa<thorin::PrimLit>()))
+                        break;
+                    value = world.extract(value, index);
+                }
+                if (!constant_indices || !is_constant(value))
+                    continue;
+                load->out_val()->replace_uses(value);
+                load->out_mem()->replace_uses(load->mem());
+                global_folded++;
+            }
+        }
+
+        auto immutable = world.global(global->init(), false);
+        immutable->set_name(global->name());
+        global->replace_uses(immutable);
+
+        std::cerr << "  promoted " << global->unique_name() << " to immutable, folded " << global_folded << " of "
+                  << loads.size() << " loads" << std::endl;
+        promoted++;
+        folded += global_folded;
+    }
+
+    std::cerr << "  promoted " << promoted << " of " << candidates.size() << " internal mutable globals, folded " << folded << " loads" << std::endl;
+    return promoted > 0;
+}
+
+}
@@ -0,0 +1,335 @@
+#include "anyopt/stream.h"
+
+#include<nlohmann/json.hpp>
+
+#include<chrono>
+#include<cstdio>
+#include<cstring>
+#include<fstream>
+#include<functional>
+#include<iostream>
+#include<map>
+#include<set>
+#include<thread>
+#include<vector>
+
+#include<fcntl.h>
+#include<signal.h>
+#include<sys/resource.h>
+#include<sys/wait.h>
+#include<unistd.h>
+
+using json = nlohmann::json;
+using namespace anyopt;
+
+static void usage() {
+    std::cout << "usage: anyopt-reduce [options] file -- [anyopt options]\n"
+                 "Shrinks an input module while anyopt, run with the given options, stays slower or larger than a threshold.\n"
+                 "  -h     --help                 Displays this message\n"
+                 "         --anyopt <path>        anyopt executable (defaults to anyopt)\n"
+                 "         --time <seconds>       The module is interesting while anyopt runs at least this long after loading it\n"
+                 "         --memory <MiB>         The module is interesting while anyopt's peak memory use is at least this large\n"
+                 "  -o <file>                     Writes the reduced module to <file> (defaults to reduced.json)\n"
+                 ;
+}
+
+struct Options {
+    std::string input;
+    std::string output = "reduced.json";
+    std::string anyopt = "anyopt";
+    std::vector<std::string> args;
+    double time = 0;
+    long memory_kb = 0;
+};
+
+struct Run {
+    bool ok = false;
+    bool timed_out = false;
+    double seconds = 0;
+    long max_rss_kb = 0;
+};
+
+/// Runs anyopt on file and waits for it, killing it after timeout seconds (if positive).
+static Run run_anyopt (const Options& opts, const std::string& file, const std::vector<std::string>& args, double timeout) {
+    std::vector<std::string> argv_storage = { opts.anyopt, file };
+    argv_storage.insert(argv_storage.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (auto& arg : argv_storage)
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    Run run;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return run;
+    }
+    if (pid == 0) {
+        //The reproducer's outputs are irrelevant, only its cost counts.
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    while (true) {
+        pid_t done = wait4(pid, &status, WNOHANG, &usage);
+        run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (done == pid)
+            break;
+        if (done < 0) {
+            perror("wait4");
+            return run;
+        }
+        if (timeout > 0 && run.seconds > timeout && !run.timed_out) {
+            kill(pid, SIGKILL);
+            run.timed_out = true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    run.max_rss_kb = usage.ru_maxrss;
+    run.ok = !run.timed_out && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    return run;
+}
+
+/// Names a def description refers to, including params and types, found by walking every string in it.
+static void collect_names (const json& value, std::vector<std::string>& names) {
+    if (value.is_string()) {
+        names.push_back(value.get<std::string>());
+    } else if (value.is_structured()) {
+        for (auto& element : value)
+            collect_names(element, names);
+    }
+}
+
+class Reducer {
+public:
+    Reducer(const Options& opts, json module) : opts_(opts), module_(std::move(module)) {}
+
+    bool run ();
+
+private:
+    json build (const std::vector<size_t>& defs, const std::vector<size_t>& types) const;
+    json collect (const std::vector<size_t>& roots, const std::vector<size_t>& types) const;
+    bool interesting (const json& candidate);
+    std::vector<size_t> ddmin (std::vector<size_t> items, const std::function<json(const std::vector<size_t>&)>& candidate);
+
+    const Options& opts_;
+    json module_;
+    size_t tests_ = 0;
+};
+
+json Reducer::build (const std::vector<size_t>& defs, const std::vector<size_t>& types) const {
+    json candidate = module_;
+    candidate["defs"] = json::array();
+    for (auto i : defs)
+        candidate["defs"].push_back(module_["defs"][i]);
+    candidate["type_table"] = json::array();
+    for (auto i : types)
+        candidate["type_table"].push_back(module_["type_table"][i]);
+    return candidate;
+}
+
+/// Module made of the given root defs and every def and type they transitively refer to.
+json Reducer::collect (const std::vector<size_t>& roots, const std::vector<size_t>& types) const {
+    auto& defs = module_["defs"];
+    std::map<std::string, size_t> owner;
+    for (size_t i = 0; i < defs.size(); ++i) {
+        owner[defs[i]["name"].get<std::string>()] = i;
+        if (defs[i].contains("arg_names")) {
+            for (auto& param : defs[i]["arg_names"])
+                owner[param.get<std::string>()] = i;
+        }
+    }
+    std::map<std::string, size_t> type_owner;
+    for (auto i : types)
+        type_owner[module_["type_table"][i]["name"].get<std::string>()] = i;
+
+    std::set<size_t> kept_defs(roots.begin(), roots.end());
+    std::set<size_t> kept_types;
+    std::vector<const json*> queue;
+    for (auto i : roots)
+        queue.push_back(&defs[i]);
+    while (!queue.empty()) {
+        auto desc = queue.back();
+        queue.pop_back();
+
+        std::vector<std::string> names;
+        collect_names(*desc, names);
+        for (auto& name : names) {
+            auto def = owner.find(name);
+            if (def != owner.end() && kept_defs.insert(def->second).second)
+                queue.push_back(&defs[def->second]);
+            auto type = type_owner.find(name);
+            if (type != type_owner.end() && kept_types.insert(type->second).second)
+                queue.push_back(&module_["type_table"][type->second]);
+        }
+    }
+
+    return build({ kept_defs.begin(), kept_defs.end() }, { kept_types.begin(), kept_types.end() });
+}
+
+bool Reducer::interesting (const json& candidate) {
+    tests_++;
+    auto file = opts_.output + ".candidate.json";
+    {
+        std::ofstream out(file);
+        out << candidate.dump();
+    }
+
+    //A module that does not load any more is no reproducer, and loading alone must not be what is slow.
+    auto load = run_anyopt(opts_, file, {}, 0);
+    if (!load.ok)
+        return false;
+
+    //Past load time plus the threshold, the passes alone are slow enough, so there is no need to wait any longer.
+    double timeout = opts_.time > 0 ? load.seconds + opts_.time * 1.1 : 0;
+    auto run = run_anyopt(opts_, file, opts_.args, timeout);
+    if (run.timed_out)
+        return true;
+    if (!run.ok)
+        return false;
+    if (opts_.time > 0 && run.seconds - load.seconds >= opts_.time)
+        return true;
+    if (opts_.memory_kb > 0 && run.max_rss_kb >= opts_.memory_kb)
+        return true;
+    return false;
+}
+
+/// Delta debugging: removes ever smaller chunks of items as long as the candidate built from the rest stays interesting.
+std::vector<size_t> Reducer::ddmin (std::vector<size_t> items, const std::function<json(const std::vector<size_t>&)>& candidate) {
+    size_t chunks = 2;
+    while (items.size() >= 2) {
+        size_t chunk_size = (items.size() + chunks - 1) / chunks;
+        bool reduced = false;
+        for (size_t start = 0; start < items.size(); start += chunk_size) {
+            std::vector<size_t> rest(items.begin(), items.begin() + start);
+            rest.insert(rest.end(), items.begin() + std::min(start + chunk_size, items.size()), items.end());
+            if (interesting(candidate(rest))) {
+                items = rest;
+                chunks = std::max<size_t>(chunks - 1, 2);
+                reduced = true;
+                std::cerr << "  " << items.size() << " left after " << tests_ << " tests" << std::endl;
+                break;
+            }
+        }
+        if (!reduced) {
+            if (chunks >= items.size())
+                break;
+            chunks = std::min(chunks * 2, items.size());
+        }
+    }
+    return items;
+}
+
+bool Reducer::run () {
+    if (module_.value("version", 1) != 1) {
+        std::cerr << "only version 1 modules can be reduced" << std::endl;
+        return false;
+    }
+
+    std::vector<size_t> all_types(module_["type_table"].size());
+    for (size_t i = 0; i < all_types.size(); ++i)
+        all_types[i] = i;
+
+    std::vector<size_t> roots;
+    for (size_t i = 0; i < module_["defs"].size(); ++i) {
+        if (module_["defs"][i].contains("external"))
+            roots.push_back(i);
+    }
+
+    std::cerr << "Checking the original module" << std::endl;
+    if (!interesting(collect(roots, all_types))) {
+        std::cerr << "the input does not exceed the thresholds, nothing to reduce" << std::endl;
+        return false;
+    }
+
+    std::cerr << "Reducing " << roots.size() << " externals" << std::endl;
+    roots = ddmin(roots, [&] (const std::vector<size_t>& items) { return collect(items, all_types); });
+    module_ = collect(roots, all_types);
+
+    std::cerr << "Reducing " << module_["defs"].size() << " defs" << std::endl;
+    std::vector<size_t> defs(module_["defs"].size());
+    for (size_t i = 0; i < defs.size(); ++i)
+        defs[i] = i;
+    std::vector<size_t> types(module_["type_table"].size());
+    for (size_t i = 0; i < types.size(); ++i)
+        types[i] = i;
+    defs = ddmin(defs, [&] (const std::vector<size_t>& items) { return build(items, types); });
+    module_ = build(defs, types);
+
+    std::cerr << "Reducing " << module_["type_table"].size() << " types" << std::endl;
+    defs.resize(module_["defs"].size());
+    for (size_t i = 0; i < defs.size(); ++i)
+        defs[i] = i;
+    types.resize(module_["type_table"].size());
+    for (size_t i = 0; i < types.size(); ++i)
+        types[i] = i;
+    types = ddmin(types, [&] (const std::vector<size_t>& items) { return build(defs, items); });
+    module_ = build(defs, types);
+
+    std::remove((opts_.output + ".candidate.json").c_str());
+    std::ofstream out(opts_.output);
+    if (!out) {
+        std::cerr << "cannot open '" << opts_.output << "' for writing" << std::endl;
+        return false;
+    }
+    out << module_.dump(2) << std::endl;
+    std::cerr << "Wrote " << module_["defs"].size() << " defs and " << module_["type_table"].size() << " types to "
+              << opts_.output << " after " << tests_ << " tests" << std::endl;
+    return true;
+}
+
+int main (int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        auto matches = [&] (const char* opt) { return !strcmp(argv[i], opt); };
+        auto value = [&] () -> const char* {
+            if (i + 1 >= argc) {
+                std::cerr << "missing argument for option '" << argv[i] << "'" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+
+        if (matches("-h") || matches("--help")) {
+            usage();
+            return EXIT_SUCCESS;
+        } else if (matches("--anyopt")) {
+            opts.anyopt = value();
+        } else if (matches("--time")) {
+            opts.time = std::strtod(value(), NULL);
+        } else if (matches("--memory")) {
+            opts.memory_kb = std::strtol(value(), NULL, 10) * 1024;
+        } else if (matches("-o")) {
+            opts.output = value();
+        } else if (matches("--")) {
+            opts.args.assign(argv + i + 1, argv + argc);
+            break;
+        } else if (argv[i][0] == '-') {
+            std::cerr << "unknown option '" << argv[i] << "'" << std::endl;
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            opts.input = argv[i];
+        }
+    }
+
+    if (opts.input == "" || (opts.time <= 0 && opts.memory_kb <= 0)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    auto input = open_input(opts.input);
+    if (!input) {
+        std::cerr << "cannot open '" << opts.input << "' for reading" << std::endl;
+        return EXIT_FAILURE;
+    }
+    Reducer reducer(opts, json::parse(*input));
+    return reducer.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,507 @@
+#include "anyopt/stream.h"
+
+#include<cerrno>
+#include<cstring>
+#include<fstream>
+#include<map>
+#include<vector>
+
+#include<fcntl.h>
+#include<unistd.h>
+
+#ifdef ANYOPT_HAS_ZLIB
+#include<zlib.h>
+#endif
+#ifdef ANYOPT_HAS_ZSTD
+#include<zstd.h>
+#endif
+
+namespace anyopt {
+
+static const size_t BufferSize = 1 << 18;
+
+#ifdef ANYOPT_HAS_ZLIB
+class GzipInBuf : public std::streambuf {
+public:
+    GzipInBuf(std::istream& source) : source_(source), in_(BufferSize), out_(BufferSize) {
+        stream_.zalloc = Z_NULL;
+        stream_.zfree = Z_NULL;
+        stream_.opaque = Z_NULL;
+        stream_.next_in = Z_NULL;
+        stream_.avail_in = 0;
+        //15 + 32: maximum window size, detect the gzip header automatically.
+        inflateInit2(&stream_, 15 + 32);
+    }
+    ~GzipInBuf() { inflateEnd(&stream_); }
+
+protected:
+    int_type underflow() override {
+        while (true) {
+            //inflate may hold back output when the last call filled the whole buffer, so drain it before reading more input.
+            if (stream_.avail_in == 0 && !pending_) {
+                source_.read(in_.data(), in_.size());
+                stream_.next_in = reinterpret_cast<Bytef*>(in_.data());
+                stream_.avail_in = source_.gcount();
+                if (stream_.avail_in == 0) {
+                    if (!ended_)
+                        std::cerr << "gzip: unexpected end of input" << std::endl;
+                    return traits_type::eof();
+                }
+            }
+
+            stream_.next_out = reinterpret_cast<Bytef*>(out_.data());
+            stream_.avail_out = out_.size();
+            int ret = inflate(&stream_, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                //Concatenated gzip members are decompressed one after another.
+                inflateReset(&stream_);
+                ended_ = true;
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                std::cerr << "gzip: " << (stream_.msg ? stream_.msg : "corrupt input") << std::endl;
+                return traits_type::eof();
+            } else if (ret == Z_OK) {
+                ended_ = false;
+            }
+
+            pending_ = stream_.avail_out == 0;
+            size_t produced = out_.size() - stream_.avail_out;
+            if (produced > 0) {
+                setg(out_.data(), out_.data(), out_.data() + produced);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+    }
+
+private:
+    std::istream& source_;
+    std::vector<char> in_;
+    std::vector<char> out_;
+    z_stream stream_;
+    bool pending_ = false;
+    bool ended_ = true;
+};
+
+class GzipOutBuf : public std::streambuf {
+public:
+    GzipOutBuf(std::ostream& sink) : sink_(sink), in_(BufferSize), out_(BufferSize) {
+        stream_.zalloc = Z_NULL;
+        stream_.zfree = Z_NULL;
+        stream_.opaque = Z_NULL;
+        //15 + 16: maximum window size, write a gzip header.
+        deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+        setp(in_.data(), in_.data() + in_.size());
+    }
+    ~GzipOutBuf() {
+        compress(Z_FINISH);
+        deflateEnd(&stream_);
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!compress(Z_NO_FLUSH))
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    //Flushing the zlib stream on every std::endl would ruin the compression ratio, so only the buffered input is handed over.
+    int sync() override { return compress(Z_NO_FLUSH) ? 0 : -1; }
+
+private:
+    bool compress(int flush) {
+        stream_.next_in = reinterpret_cast<Bytef*>(pbase());
+        stream_.avail_in = pptr() - pbase();
+        int ret;
+        do {
+            stream_.next_out = reinterpret_cast<Bytef*>(out_.data());
+            stream_.avail_out = out_.size();
+            ret = deflate(&stream_, flush);
+            if (ret == Z_STREAM_ERROR)
+                return false;
+            sink_.write(out_.data(), out_.size() - stream_.avail_out);
+        } while (stream_.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+        setp(in_.data(), in_.data() + in_.size());
+        return bool(sink_);
+    }
+
+    std::ostream& sink_;
+    std::vector<char> in_;
+    std::vector<char> out_;
+    z_stream stream_;
+};
+#endif
+
+#ifdef ANYOPT_HAS_ZSTD
+class ZstdInBuf : public std::streambuf {
+public:
+    ZstdInBuf(std::istream& source) : source_(source), in_(ZSTD_DStreamInSize()), out_(ZSTD_DStreamOutSize()), stream_(ZSTD_createDStream()) {
+        ZSTD_initDStream(stream_);
+    }
+    ~ZstdInBuf() { ZSTD_freeDStream(stream_); }
+
+protected:
+    int_type underflow() override {
+        while (true) {
+            //zstd may hold back output when the last call filled the whole buffer, so drain it before reading more input.
+            if (input_.pos == input_.size && !pending_) {
+                source_.read(in_.data(), in_.size());
+                input_ = { in_.data(), static_cast<size_t>(source_.gcount()), 0 };
+                if (input_.size == 0) {
+                    //A non zero hint means the last frame is incomplete.
+                    if (hint_ != 0)
+                        std::cerr << "zstd: unexpected end of input" << std::endl;
+                    return traits_type::eof();
+                }
+            }
+
+            ZSTD_outBuffer output = { out_.data(), out_.size(), 0 };
+            hint_ = ZSTD_decompressStream(stream_, &output, &input_);
+            if (ZSTD_isError(hint_)) {
+                std::cerr << "zstd: " << ZSTD_getErrorName(hint_) << std::endl;
+                return traits_type::eof();
+            }
+
+            pending_ = output.pos == output.size;
+            if (output.pos > 0) {
+                setg(out_.data(), out_.data(), out_.data() + output.pos);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+    }
+
+private:
+    std::istream& source_;
+    std::vector<char> in_;
+    std::vector<char> out_;
+    ZSTD_DStream* stream_;
+    ZSTD_inBuffer input_ = { nullptr, 0, 0 };
+    size_t hint_ = 0;
+    bool pending_ = false;
+};
+
+class ZstdOutBuf : public std::streambuf {
+public:
+    ZstdOutBuf(std::ostream& sink) : sink_(sink), in_(ZSTD_CStreamInSize()), out_(ZSTD_CStreamOutSize()), context_(ZSTD_createCCtx()) {
+        setp(in_.data(), in_.data() + in_.size());
+    }
+    ~ZstdOutBuf() {
+        compress(ZSTD_e_end);
+        ZSTD_freeCCtx(context_);
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!compress(ZSTD_e_continue))
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override { return compress(ZSTD_e_continue) ? 0 : -1; }
+
+private:
+    bool compress(ZSTD_EndDirective mode) {
+        ZSTD_inBuffer input = { pbase(), static_cast<size_t>(pptr() - pbase()), 0 };
+        size_t remaining;
+        do {
+            ZSTD_outBuffer output = { out_.data(), out_.size(), 0 };
+            remaining = ZSTD_compressStream2(context_, &output, &input, mode);
+            if (ZSTD_isError(remaining)) {
+                std::cerr << "zstd: " << ZSTD_getErrorName(remaining) << std::endl;
+                return false;
+            }
+            sink_.write(out_.data(), output.pos);
+        } while (mode == ZSTD_e_end ? remaining != 0 : input.pos != input.size);
+        setp(in_.data(), in_.data() + in_.size());
+        return bool(sink_);
+    }
+
+    std::ostream& sink_;
+    std::vector<char> in_;
+    std::vector<char> out_;
+    ZSTD_CCtx* context_;
+};
+#endif
+
+/// Reads a file descriptor, see open_input("-").
+class FdInBuf : public std::streambuf {
+public:
+    FdInBuf(int fd) : fd_(fd), in_(BufferSize) { setg(in_.data(), in_.data(), in_.data()); }
+
+    /// Reads until at least size bytes are buffered or the input ends, so the magic bytes can be inspected without consuming them.
+    size_t peek (unsigned char* magic, size_t size) {
+        while (size_t(egptr() - gptr()) < size) {
+            ssize_t count = read_some(egptr(), in_.data() + in_.size() - egptr());
+            if (count <= 0)
+                break;
+            setg(eback(), gptr(), egptr() + count);
+        }
+        size = std::min(size, size_t(egptr() - gptr()));
+        std::memcpy(magic, gptr(), size);
+        return size;
+    }
+
+protected:
+    int_type underflow() override {
+        ssize_t count = read_some(in_.data(), in_.size());
+        if (count <= 0)
+            return traits_type::eof();
+        setg(in_.data(), in_.data(), in_.data() + count);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    ssize_t read_some(char* buffer, size_t size) {
+        ssize_t count;
+        do {
+            count = ::read(fd_, buffer, size);
+        } while (count < 0 && errno == EINTR);
+        return count;
+    }
+
+    int fd_;
+    std::vector<char> in_;
+};
+
+/// Outputs announced with expect_output that have not been closed yet, by file descriptor.
+static std::map<int, size_t> fd_users;
+
+/// Parses "fd:N", returns -1 for anything else.
+static int parse_fd_target (const std::string& filename) {
+    if (filename.compare(0, 3, "fd:") != 0)
+        return -1;
+    char* end;
+    long fd = std::strtol(filename.c_str() + 3, &end, 10);
+    if (*end || end == filename.c_str() + 3 || fd < 0)
+        return -1;
+    return fd;
+}
+
+/// Writes a file descriptor in large blocks, see open_output.
+/// Closes it in the end, unless it is stdin, stdout or stderr, or another expected output still writes to it.
+class FdOutBuf : public std::streambuf {
+public:
+    FdOutBuf(int fd) : fd_(fd), out_(BufferSize) { setp(out_.data(), out_.data() + out_.size()); }
+    ~FdOutBuf() {
+        flush();
+        if (fd_ <= STDERR_FILENO)
+            return;
+        auto users = fd_users.find(fd_);
+        if (users != fd_users.end() && --users->second > 0)
+            return;
+        if (users != fd_users.end())
+            fd_users.erase(users);
+        ::close(fd_);
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        if (!flush())
+            return traits_type::eof();
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            *pptr() = traits_type::to_char_type(c);
+            pbump(1);
+        }
+        return traits_type::not_eof(c);
+    }
+
+    //Writes bigger than the buffer bypass it.
+    std::streamsize xsputn(const char* data, std::streamsize size) override {
+        if (size < epptr() - pptr())
+            return std::streambuf::xsputn(data, size);
+        if (!flush() || !write_all(data, size))
+            return 0;
+        return size;
+    }
+
+    int sync() override { return flush() ? 0 : -1; }
+
+private:
+    bool flush() {
+        bool ok = write_all(pbase(), pptr() - pbase());
+        setp(out_.data(), out_.data() + out_.size());
+        return ok;
+    }
+
+    bool write_all(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t count = ::write(fd_, data, size);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    int fd_;
+    std::vector<char> out_;
+};
+
+/// A stream that owns its buffer.
+template<class Stream, class Buf>
+class BufStream : public Stream {
+public:
+    BufStream(std::unique_ptr<Buf> buf) : Stream(buf.get()), buf_(std::move(buf)) {}
+
+    Buf& buf() { return *buf_; }
+
+private:
+    std::unique_ptr<Buf> buf_;
+};
+
+typedef BufStream<std::istream, FdInBuf> FdInStream;
+typedef BufStream<std::ostream, FdOutBuf> FdOutStream;
+
+/// A stream that owns the file it reads from or writes to, and the (de)compressing buffer in between.
+template<class Stream, class File>
+class CompressedStream : public Stream {
+public:
+    CompressedStream(std::unique_ptr<File> file, std::unique_ptr<std::streambuf> buf)
+        : Stream(buf.get()), file_(std::move(file)), buf_(std::move(buf)) {}
+
+private:
+    //The buffer is destroyed first, so a compressor can still finish its stream into the file.
+    std::unique_ptr<File> file_;
+    std::unique_ptr<std::streambuf> buf_;
+};
+
+Compression compression_from_extension (const std::string& filename) {
+    auto ends_with = [&] (const std::string& ext) {
+        return filename.size() >= ext.size() && filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+    };
+    if (ends_with(".gz"))
+        return Compression::Gzip;
+    if (ends_with(".zst"))
+        return Compression::Zstd;
+    return Compression::None;
+}
+
+const char* compression_extension (Compression compression) {
+    switch (compression) {
+        case Compression::Gzip: return ".gz";
+        case Compression::Zstd: return ".zst";
+        default: return "";
+    }
+}
+
+static bool compression_supported (Compression compression, const std::string& filename) {
+    switch (compression) {
+#ifndef ANYOPT_HAS_ZLIB
+        case Compression::Gzip:
+            std::cerr << "cannot handle '" << filename << "': anyopt was built without gzip support" << std::endl;
+            return false;
+#endif
+#ifndef ANYOPT_HAS_ZSTD
+        case Compression::Zstd:
+            std::cerr << "cannot handle '" << filename << "': anyopt was built without zstd support" << std::endl;
+            return false;
+#endif
+        default:
+            return true;
+    }
+}
+
+static Compression compression_from_magic (const unsigned char* magic, size_t count) {
+    if (count >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return Compression::Gzip;
+    if (count >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return Compression::Zstd;
+    return Compression::None;
+}
+
+/// Puts a (de)compressing buffer between the stream and file, if the compression asks for one.
+template<class Stream, class File>
+static std::unique_ptr<Stream> wrap (std::unique_ptr<File> file, Compression compression) {
+    switch (compression) {
+#ifdef ANYOPT_HAS_ZLIB
+        case Compression::Gzip: {
+            std::unique_ptr<std::streambuf> buf;
+            if constexpr (std::is_base_of_v<std::istream, Stream>)
+                buf = std::make_unique<GzipInBuf>(*file);
+            else
+                buf = std::make_unique<GzipOutBuf>(*file);
+            return std::make_unique<CompressedStream<Stream, File>>(std::move(file), std::move(buf));
+        }
+#endif
+#ifdef ANYOPT_HAS_ZSTD
+        case Compression::Zstd: {
+            std::unique_ptr<std::streambuf> buf;
+            if constexpr (std::is_base_of_v<std::istream, Stream>)
+                buf = std::make_unique<ZstdInBuf>(*file);
+            else
+                buf = std::make_unique<ZstdOutBuf>(*file);
+            return std::make_unique<CompressedStream<Stream, File>>(std::move(file), std::move(buf));
+        }
+#endif
+        default:
+            return file;
+    }
+}
+
+std::unique_ptr<std::istream> open_input (const std::string& filename) {
+    unsigned char magic[4] = {};
+
+    if (filename == "-") {
+        auto in = std::make_unique<FdInStream>(std::make_unique<FdInBuf>(STDIN_FILENO));
+        auto compression = compression_from_magic(magic, in->buf().peek(magic, sizeof(magic)));
+        if (!compression_supported(compression, filename))
+            return nullptr;
+        return wrap<std::istream>(std::move(in), compression);
+    }
+
+    auto file = std::make_unique<std::ifstream>(filename, std::ios::binary);
+    if (!*file)
+        return nullptr;
+
+    file->read(reinterpret_cast<char*>(magic), sizeof(magic));
+    auto compression = compression_from_magic(magic, file->gcount());
+    file->clear();
+    file->seekg(0);
+
+    if (!compression_supported(compression, filename))
+        return nullptr;
+    return wrap<std::istream>(std::move(file), compression);
+}
+
+void expect_output (const std::string& filename) {
+    int fd = parse_fd_target(filename);
+    if (fd > STDERR_FILENO)
+        fd_users[fd]++;
+}
+
+bool is_stream_target (const std::string& filename) {
+    return filename == "-" || filename.compare(0, 3, "fd:") == 0;
+}
+
+std::unique_ptr<std::ostream> open_output (const std::string& filename, Compression compression) {
+    if (!compression_supported(compression, filename))
+        return nullptr;
+
+    int fd;
+    if (filename == "-") {
+        //Whatever went to std::cout so far comes first.
+        std::cout.flush();
+        fd = STDOUT_FILENO;
+    } else if (filename.compare(0, 3, "fd:") == 0) {
+        fd = parse_fd_target(filename);
+        if (fd < 0 || fcntl(fd, F_GETFD) < 0)
+            return nullptr;
+    } else {
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd < 0)
+            return nullptr;
+    }
+
+    return wrap<std::ostream>(std::make_unique<FdOutStream>(std::make_unique<FdOutBuf>(fd)), compression);
+}
+
+}
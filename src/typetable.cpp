@@ -2,7 +2,14 @@
 
 namespace anyopt {
 
-TypeTable::OptiType TypeTable::resolvetype (std::string type_name) {
+size_t TypeKeyHash::operator()(const TypeKey& key) const {
+    size_t hash = std::hash<std::string>()(key.attrs) ^ static_cast<size_t>(key.kind);
+    for (auto arg : key.args)
+        hash = hash * 31 + std::hash<const thorin::Type*>()(arg);
+    return hash;
+}
+
+OptiType TypeTable::resolvetype (std::string type_name) {
     static const std::map<std::string, OptiType> TypeMap {
 #define MAP(NAME, CLASS) {NAME, OptiType::CLASS},
         TypeTableEnum(MAP)
@@ -50,121 +57,198 @@ thorin::AddrSpace TypeTable::resolveaddrspace (std::string addr_space) {
     }
 }
 
-thorin::Array<const thorin::Type*> TypeTable::get_arglist (json arg_list) {
+thorin::Array<const thorin::Type*> TypeTable::get_arglist (const json& arg_list) {
     //Get all argument types based on their alias.
     thorin::Array<const thorin::Type*> args(arg_list.size());
     for (int argnum = 0; argnum < arg_list.size(); ++argnum) {
-        json arg_desc = arg_list[argnum];
+        const json& arg_desc = arg_list[argnum];
         args[argnum] = get_type(arg_desc);
     }
 
     return args;
 }
 
+TypeKey TypeTable::structural_key (OptiType kind, const json& desc) {
+    TypeKey key { kind, {}, {} };
+    if (desc.contains("args")) {
+        for (auto& arg : desc["args"])
+            key.args.push_back(get_type(arg));
+    }
+    for (auto attr : { "tag", "length", "addrspace" }) {
+        if (desc.contains(attr))
+            key.attrs += desc[attr].dump() + ";";
+    }
+    return key;
+}
+
+thorin::NominalType* TypeTable::build_nominal (OptiType kind, std::string nominal_name, const json& desc) {
+    thorin::NominalType* nominal_type = nullptr;
+    auto arg_names = desc["arg_names"].get<std::vector<std::string>>();
+
+    auto create = [&] () -> thorin::NominalType* {
+        if (kind == OptiType::StructType)
+            return world().struct_type(nominal_name, arg_names.size());
+        else
+            return world().variant_type(nominal_name, arg_names.size());
+    };
+
+    thorin::Array<const thorin::Type*> args;
+    if (desc.contains("args")) {
+        args = get_arglist(desc["args"]);
+        if (kind == OptiType::StructType)
+            assert(arg_names.size() == args.size());
+    }
+
+    auto same_ops = [&] (const thorin::NominalType* type) {
+        if (type->num_ops() != args.size())
+            return false;
+        for (size_t i = 0; i < args.size(); ++i) {
+            if (type->op(i) != args[i])
+                return false;
+        }
+        return true;
+    };
+
+    //Resolving the fields may have declared this type on demand, so look for a forward declaration only now.
+    if (auto forward_decl = find_type(desc["name"])) {
+        nominal_type = const_cast<thorin::NominalType*>(forward_decl->as<thorin::NominalType>());
+    } else {
+        //Nominal types are unified across files by name and field names, as long as their fields agree.
+        //A forward declaration cannot be checked against the fields of a complete cached type yet, so it gets a type of its own.
+        auto& cached = cache_.nominal[{ nominal_name, arg_names }];
+        if (!cached)
+            nominal_type = cached = create();
+        else if (cache_.complete.count(cached) && (!desc.contains("args") || !same_ops(cached)))
+            nominal_type = create();
+        else
+            nominal_type = cached;
+    }
+
+    if (desc.contains("args")) {
+        if (cache_.complete.count(nominal_type)) {
+            if (!same_ops(nominal_type)) {
+                std::cerr << "Conflicting definitions of nominal type " << nominal_name << std::endl;
+                assert(false && "Conflicting definitions of a nominal type!");
+            }
+        } else {
+            for (size_t i = 0; i < args.size(); ++i) {
+                nominal_type->set_op(i, args[i]);
+                nominal_type->set_op_name(i, arg_names[i]);
+            }
+            cache_.complete.emplace(nominal_type);
+        }
+    }
+
+    return nominal_type;
+}
+
+const thorin::Type* TypeTable::find_type (size_t position) {
+    return position < indexed_types.size() ? indexed_types[position] : nullptr;
+}
+
+const thorin::Type* TypeTable::find_type (const json& name) {
+    if (name.is_number())
+        return find_type(name.get<size_t>());
+    auto it = known_types.find(name.get_ref<const std::string&>());
+    return it != known_types.end() ? it->second : nullptr;
+}
+
+const thorin::Type*& TypeTable::type_slot (const json& name) {
+    if (name.is_number()) {
+        size_t id = name;
+        if (id >= indexed_types.size())
+            indexed_types.resize(id + 1, nullptr);
+        return indexed_types[id];
+    }
+    return known_types[name];
+}
+
+const thorin::Type* TypeTable::get_type (const json& type_ref) {
+    if (type_ref.is_string())
+        return get_type(type_ref.get<std::string>());
+    return get_type(type_ref.get<size_t>());
+}
+
+const thorin::Type* TypeTable::get_type (size_t position) {
+    auto type = find_type(position);
+    if (!type && pending_types_)
+        type = build_pending(position, { position });
+    if (!type)
+        std::cerr << "Unknown argument type: #" << position << std::endl;
+    assert(type && "Unknown argument type!");
+    return type;
+}
+
 const thorin::Type* TypeTable::get_type (std::string type_name) {
     auto it = known_types.find(type_name);
+    if (it == known_types.end() && pending_types_) {
+        auto positions = type_index.find(type_name);
+        if (positions != type_index.end()) {
+            if (auto type = build_pending(type_name, positions->second))
+                return type;
+        }
+    }
     if (it == known_types.end())
         std::cerr << "Unknown argument type: " << type_name << std::endl;
     assert(it != known_types.end() && "Unknown argument type!");
     return it->second;
 }
 
-const thorin::Type * TypeTable::build_DefiniteArrayType(json desc) {
+const thorin::Type * TypeTable::build_DefiniteArrayType(const json& desc) {
         auto args = get_arglist(desc["args"]);
         assert(args.size() == 1);
         size_t length = desc["length"].get<size_t>();
         return world().definite_array_type(args[0], length);
 }
 
-const thorin::Type * TypeTable::build_IndefiniteArrayType(json desc) {
+const thorin::Type * TypeTable::build_IndefiniteArrayType(const json& desc) {
         auto args = get_arglist(desc["args"]);
         assert(args.size() == 1);
         return world().indefinite_array_type(args[0]);
 }
 
-const thorin::Type * TypeTable::build_BottomType(json desc) {
+const thorin::Type * TypeTable::build_BottomType(const json& desc) {
         return world().bottom_type();
 }
 
-const thorin::Type * TypeTable::build_FnType(json desc) {
+const thorin::Type * TypeTable::build_FnType(const json& desc) {
         auto args = get_arglist(desc["args"]);
         return world().fn_type(args);
 }
 
-const thorin::Type * TypeTable::build_ClosureType(json desc) {
+const thorin::Type * TypeTable::build_ClosureType(const json& desc) {
         auto args = get_arglist(desc["args"]);
         return world().closure_type(args);
 }
 
-const thorin::Type * TypeTable::build_FrameType(json desc) {
+const thorin::Type * TypeTable::build_FrameType(const json& desc) {
         return world().bottom_type();
 }
 
-const thorin::Type * TypeTable::build_MemType(json desc) {
+const thorin::Type * TypeTable::build_MemType(const json& desc) {
         return world().mem_type();
 }
 
-const thorin::Type * TypeTable::build_StructType(json desc) {
-        thorin::StructType* struct_type;
-        auto forward_decl = known_types.find(desc["name"]);
-        auto arg_names = desc["arg_names"];
-
-        if (forward_decl != known_types.end()) {
-            struct_type = const_cast<thorin::StructType*>(forward_decl->second->as<thorin::StructType>());
-        } else {
-            auto name = desc["struct_name"].get<std::string>();
-            struct_type = world().struct_type(name, arg_names.size());
-        }
-
-        if (desc.contains("args")) {
-            auto args = get_arglist(desc["args"]);
-            assert(arg_names.size() == args.size());
-            for (size_t i = 0; i < args.size(); ++i) {
-                auto arg_name = desc["arg_names"][i].get<std::string>();
-                struct_type->set_op(i, args[i]);
-                struct_type->set_op_name(i, arg_name);
-            }
-        }
-
-        return struct_type;
+const thorin::Type * TypeTable::build_StructType(const json& desc) {
+        return build_nominal(OptiType::StructType, desc["struct_name"].get<std::string>(), desc);
 }
 
-const thorin::Type * TypeTable::build_VariantType(json desc) {
-        thorin::VariantType* variant_type;
-        auto forward_decl = known_types.find(desc["name"]);
-        auto arg_names = desc["arg_names"];
-
-        if (forward_decl != known_types.end()) {
-            variant_type = const_cast<thorin::VariantType*>(forward_decl->second->as<thorin::VariantType>());
-        } else {
-            auto name = desc["variant_name"].get<std::string>();
-            variant_type = world().variant_type(name, arg_names.size());
-        }
-
-        if (desc.contains("args")) {
-            auto args = get_arglist(desc["args"]);
-            for (size_t i = 0; i < args.size(); ++i) {
-                auto arg_name = desc["arg_names"][i].get<std::string>();
-                variant_type->set_op(i, args[i]);
-                variant_type->set_op_name(i, arg_name);
-            }
-        }
-
-        return variant_type;
+const thorin::Type * TypeTable::build_VariantType(const json& desc) {
+        return build_nominal(OptiType::VariantType, desc["variant_name"].get<std::string>(), desc);
 }
 
-const thorin::Type * TypeTable::build_TupleType(json desc) {
+const thorin::Type * TypeTable::build_TupleType(const json& desc) {
         auto args = get_arglist(desc["args"]);
         return world().tuple_type(args);
 }
 
-const thorin::Type * TypeTable::build_PrimType(json desc) {
+const thorin::Type * TypeTable::build_PrimType(const json& desc) {
         auto tag = resolvetag(desc["tag"]);
         size_t length = desc["length"].get<size_t>();
         return world().prim_type(tag, length);
 }
 
-const thorin::Type * TypeTable::build_PtrType(json desc) {
+const thorin::Type * TypeTable::build_PtrType(const json& desc) {
         auto args = get_arglist(desc["args"]);
         assert(args.size() == 1);
         size_t length = desc["length"].get<size_t>();
@@ -177,9 +261,21 @@ const thorin::Type * TypeTable::build_PtrType(json desc) {
         return world().ptr_type(args[0], length, addrspace);
 }
 
-const thorin::Type * TypeTable::reconstruct_type(json desc) {
+const thorin::Type * TypeTable::reconstruct_type(const json& desc) {
     const thorin::Type* return_type = nullptr;
-    switch (resolvetype(desc["type"])) {
+    auto kind = resolvetype(desc["type"]);
+
+    //Structural types seen in an earlier file resolve without going through the world again.
+    TypeKey key;
+    bool structural = kind != OptiType::StructType && kind != OptiType::VariantType;
+    if (structural) {
+        key = structural_key(kind, desc);
+        auto cached = cache_.structural.find(key);
+        if (cached != cache_.structural.end())
+            return type_slot(desc["name"]) = cached->second;
+    }
+
+    switch (kind) {
 #define CASE(NAME, CLASS) case OptiType::CLASS: { return_type = build_##CLASS(desc); break; }
     TypeTableEnum(CASE)
 #undef CASE
@@ -188,7 +284,82 @@ const thorin::Type * TypeTable::reconstruct_type(json desc) {
         std::cerr << desc["name"] << std::endl;
     }
     assert(return_type);
-    return known_types[desc["name"]] = return_type;
+    if (structural)
+        cache_.structural.emplace(std::move(key), return_type);
+    return type_slot(desc["name"]) = return_type;
+}
+
+/// Builds all not yet built entries of name, so that types can be referenced before they are defined in the file.
+/// A nominal type that is referenced while its own fields are resolved is declared first and completed afterwards.
+/// Unbuilt argument types are built first from an explicit worklist, so long dependency chains do not nest on the call stack.
+const thorin::Type* TypeTable::build_pending (const json& name, const std::vector<size_t>& positions) {
+    //Entries are (position, arguments pushed), a position counts as built once its arguments are pushed.
+    std::vector<std::pair<size_t, bool>> worklist;
+    auto push = [&] (const std::vector<size_t>& pending) {
+        for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+            if (!built_positions.count(*it))
+                worklist.emplace_back(*it, false);
+        }
+    };
+
+    push(positions);
+    while (!worklist.empty()) {
+        auto [position, expanded] = worklist.back();
+        auto& desc = (*pending_types_)[position];
+        if (expanded) {
+            worklist.pop_back();
+            reconstruct_type(desc);
+            continue;
+        }
+        if (!built_positions.emplace(position).second) {
+            worklist.pop_back();
+            continue;
+        }
+        worklist.back().second = true;
+
+        if (!desc.contains("args"))
+            continue;
+        for (auto& arg : desc["args"]) {
+            if (arg.is_number()) {
+                size_t id = arg;
+                if (id < indexed_types.size() && !indexed_types[id])
+                    push({ id });
+            } else if (arg.is_string() && !known_types.count(arg)) {
+                if (auto pending = type_index.find(arg); pending != type_index.end())
+                    push(pending->second);
+            }
+        }
+    }
+    if (auto type = find_type(name))
+        return type;
+
+    auto desc = (*pending_types_)[positions.back()];
+    auto kind = resolvetype(desc["type"]);
+    if (kind != OptiType::StructType && kind != OptiType::VariantType) {
+        std::cerr << "Cyclic type: " << name << std::endl;
+        return nullptr;
+    }
+    desc.erase("args");
+    return reconstruct_type(desc);
+}
+
+/// Version 1 type tables name every entry, version 2 entries are identified by their position and refer to each other by it.
+void TypeTable::reconstruct_types(json& types, int version) {
+    for (size_t i = 0; i < types.size(); ++i) {
+        if (version == 2)
+            types[i]["name"] = i;
+        else
+            type_index[types[i]["name"]].push_back(i);
+    }
+    if (version == 2)
+        indexed_types.assign(types.size(), nullptr);
+
+    pending_types_ = &types;
+    for (size_t i = 0; i < types.size(); ++i) {
+        if (built_positions.emplace(i).second)
+            reconstruct_type(types[i]);
+    }
+    pending_types_ = nullptr;
 }
 
 }
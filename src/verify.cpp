@@ -0,0 +1,106 @@
+#include "anyopt/verify.h"
+
+#include<thorin/analyses/verify.h>
+
+#include<iostream>
+#include<unordered_set>
+
+namespace anyopt {
+
+/// The watermark recorded by the last after() is reused, so the defs are only walked again if the world was replaced in between.
+void IncrementalVerifier::before(thorin::World& world, size_t generation) {
+    if (generation == generation_)
+        return;
+    generation_ = generation;
+    max_gid_ = 0;
+    for (auto def : world.defs())
+        max_gid_ = std::max(max_gid_, def->gid());
+}
+
+bool IncrementalVerifier::verify_def(thorin::World& world, const thorin::Def* def, const char* pass) {
+    auto fail = [&] (const char* what) {
+        std::cerr << "Verification after " << pass << " failed: " << what << " in " << def->unique_name() << std::endl;
+        return false;
+    };
+
+    auto& defs = world.defs();
+    for (auto op : def->ops()) {
+        if (!op)
+            return fail("missing operand");
+        if (defs.find(op) == defs.end())
+            return fail("operand that is not part of the world");
+    }
+
+    if (auto param = def->isa<thorin::Param>()) {
+        auto continuation = param->continuation();
+        if (param->index() >= continuation->num_params() || continuation->param(param->index()) != param)
+            return fail("param that does not belong to its continuation");
+    }
+
+    if (auto app = def->isa<thorin::App>()) {
+        auto fn_type = app->callee()->type()->isa<thorin::FnType>();
+        if (!fn_type)
+            return fail("call of a value that is not a function");
+        if (fn_type->num_ops() != app->num_args())
+            return fail("call with the wrong number of arguments");
+        for (size_t i = 0; i < app->num_args(); ++i) {
+            if (app->arg(i)->type() != fn_type->op(i))
+                return fail("call with an argument of the wrong type");
+        }
+    }
+
+    return true;
+}
+
+/// Walks the defs once and only compares gids: defs above the watermark are new, and a continuation that got a new body was
+/// rewritten, jumping creates a new app. Thorin keeps no list of the defs a pass touched, so this is the cheapest way to find them.
+bool IncrementalVerifier::after(thorin::World& world, size_t generation, const char* pass) {
+    total += world.defs().size();
+
+    //The world was replaced (e.g. by cleanup), or this pass was sampled for a full check.
+    credit_ += full_rate_;
+    bool full = generation != generation_ || credit_ >= 1;
+    if (full) {
+        credit_ = std::max(credit_ - 1, 0.0);
+        full_verifies++;
+    }
+
+    bool ok = true;
+    size_t max_gid = 0;
+    std::unordered_set<const thorin::Def*> touched;
+    for (auto def : world.defs()) {
+        max_gid = std::max(max_gid, def->gid());
+        if (full) {
+            checked++;
+            ok &= verify_def(world, def, pass);
+        } else if (def->gid() > max_gid_) {
+            touched.insert(def);
+        } else if (auto continuation = def->isa_nom<thorin::Continuation>()) {
+            if (continuation->has_body() && continuation->body()->gid() > max_gid_)
+                touched.insert(continuation);
+        }
+    }
+    generation_ = generation;
+    max_gid_ = max_gid;
+
+    if (full) {
+        thorin::verify(world);
+        return ok;
+    }
+
+    std::unordered_set<const thorin::Def*> seen;
+    auto check = [&] (const thorin::Def* def) {
+        if (seen.insert(def).second) {
+            checked++;
+            ok &= verify_def(world, def, pass);
+        }
+    };
+    for (auto def : touched) {
+        check(def);
+        for (auto& use : def->uses())
+            check(use.def());
+    }
+    return ok;
+}
+
+}
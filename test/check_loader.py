@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Checks that the loader builds the same world from inputs that only differ in how they are written down.
+
+The worlds are compared through --analyze all, which reports the size, loop depth and calls of the scope of every external
+and does not depend on the order in which Thorin created the defs. The input def names that --analyze lists per scope
+are left out of the comparison, version 2 inputs and emitted modules may not have any."""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+
+def run(anyopt, inputs, flags, workdir):
+    result = subprocess.run([anyopt, *inputs, *flags], cwd=workdir, capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stderr)
+        raise RuntimeError("anyopt failed on {}".format(" ".join(inputs)))
+    return result
+
+
+def analyze(anyopt, inputs, workdir):
+    result = run(anyopt, inputs, ["--analyze", "all"], workdir)
+    scopes = json.loads(result.stdout)["scopes"]
+    for scope in scopes:
+        scope.pop("defs", None)
+    return scopes, result.stderr
+
+
+def check_order(args, fixture):
+    """Defs and types in reverse order and the version 2 schema load into the same world as the plain module."""
+    expected, _ = analyze(args.anyopt, [fixture("order.json")], args.workdir)
+    failed = False
+    for variant in ["order_reversed.json", "order_v2.json"]:
+        actual, _ = analyze(args.anyopt, [fixture(variant)], args.workdir)
+        status = "ok" if actual == expected else "MISMATCH"
+        failed |= actual != expected
+        print("{}: {}".format(variant, status))
+    return failed
+
+
+def check_dedup(args, fixture):
+    """Two files that carry the same external helpers under other def and type names share one copy of them."""
+    single, _ = analyze(args.anyopt, [fixture("dedup_a.json")], args.workdir)
+    both, stderr = analyze(args.anyopt, [fixture("dedup_a.json"), fixture("dedup_b.json")], args.workdir)
+
+    failed = False
+    reused = "Reused 2 identical top level definitions" in stderr
+    print("reused: {}".format("ok" if reused else "MISMATCH"))
+    failed |= not reused
+
+    names = [scope["name"] for scope in both]
+    unique = names == ["double_inc", "inc", "main_a", "main_b"]
+    print("externals: {}".format("ok" if unique else "MISMATCH " + ", ".join(names)))
+    failed |= not unique
+
+    #The shared helpers are the ones the first file built, and the first file's own code is unchanged.
+    for scope in single:
+        same = scope in both
+        print("{}: {}".format(scope["name"], "ok" if same else "MISMATCH"))
+        failed |= not same
+    return failed
+
+
+def check_roundtrip(args, fixture):
+    """Vector constants, tops and bottoms survive --emit-json: the emitted module and the module emitted from it again
+    load into the same world as the original."""
+    expected, _ = analyze(args.anyopt, [fixture("vector.json")], args.workdir)
+    failed = False
+    source = fixture("vector.json")
+    for generation in ["emitted", "reemitted"]:
+        run(args.anyopt, [source], ["--emit-json", "-o", "vector_" + generation], args.workdir)
+        source = os.path.join(args.workdir, "vector_{}.json".format(generation))
+        actual, _ = analyze(args.anyopt, [source], args.workdir)
+        status = "ok" if actual == expected else "MISMATCH"
+        failed |= actual != expected
+        print("{}: {}".format(generation, status))
+    return failed
+
+
+CASES = {
+    "order": check_order,
+    "dedup": check_dedup,
+    "roundtrip": check_roundtrip,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--anyopt", required=True, help="anyopt executable")
+    parser.add_argument("--fixtures", required=True, help="directory with the input modules")
+    parser.add_argument("--case", required=True, choices=sorted(CASES), help="check to run")
+    parser.add_argument("--workdir", default=".", help="directory for anyopt's outputs")
+    args = parser.parse_args()
+
+    os.makedirs(args.workdir, exist_ok=True)
+    fixture = lambda name: os.path.abspath(os.path.join(args.fixtures, name))
+    return 1 if CASES[args.case](args, fixture) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
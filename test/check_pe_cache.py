@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Checks that the pe cache keys a world by its structure alone.
+
+Every run writes its entries to a cache directory of its own, and the entry files are named after the keys. Two runs over
+the same module and a run over the module with its defs and types in reverse order, which creates them with other gids,
+have to write the same entries. A run over a filled cache has to hit every part."""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+
+def run_pe(args, input, cache):
+    result = subprocess.run([args.anyopt, input, "--pass", "pe", "--pe-cache", cache], cwd=args.workdir,
+                            capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stderr)
+        raise RuntimeError("anyopt failed on {}".format(input))
+    return result.stderr
+
+
+def entries(cache):
+    return sorted(name for name in os.listdir(cache) if not name.endswith(".tmp"))
+
+
+def check_keys(args, fixture):
+    """The same module, loaded twice and loaded in reverse order, gets the same keys, and they hit the cache."""
+    caches = {}
+    for run, input in [("first", "order.json"), ("second", "order.json"), ("reversed", "order_reversed.json")]:
+        caches[run] = os.path.join(args.workdir, "cache-" + run)
+        shutil.rmtree(caches[run], ignore_errors=True)
+        run_pe(args, fixture(input), caches[run])
+
+    failed = False
+    expected = entries(caches["first"])
+    written = bool(expected)
+    print("entries: {}".format("ok" if written else "MISMATCH none written"))
+    failed |= not written
+    for run in ["second", "reversed"]:
+        actual = entries(caches[run])
+        print("{}: {}".format(run, "ok" if actual == expected else "MISMATCH " + ", ".join(actual)))
+        failed |= actual != expected
+
+    stderr = run_pe(args, fixture("order.json"), caches["first"])
+    hit = re.search(r"^pe \((\d+) of \1 parts cached\)$", stderr, re.MULTILINE) is not None
+    print("hits: {}".format("ok" if hit else "MISMATCH"))
+    failed |= not hit
+    return failed
+
+
+CASES = {
+    "keys": check_keys,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--anyopt", required=True, help="anyopt executable")
+    parser.add_argument("--fixtures", required=True, help="directory with the input modules")
+    parser.add_argument("--case", required=True, choices=sorted(CASES), help="check to run")
+    parser.add_argument("--workdir", default=".", help="directory for anyopt's outputs and the caches")
+    args = parser.parse_args()
+
+    os.makedirs(args.workdir, exist_ok=True)
+    args.workdir = os.path.abspath(args.workdir)
+    fixture = lambda name: os.path.abspath(os.path.join(args.fixtures, name))
+    return 1 if CASES[args.case](args, fixture) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
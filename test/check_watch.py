@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Checks that --watch rebuilds the same world as a fresh run after an input file changed.
+
+main.json imports inc, which inc.json defines. anyopt watches both, inc.json is replaced by inc_edited.json, and the
+--analyze all report of the rebuild has to match the one of a fresh run over the edited files. The input def names
+that --analyze lists per scope are left out, --watch reports Thorin's names."""
+
+import argparse
+import json
+import os
+import queue
+import shutil
+import subprocess
+import sys
+import threading
+
+TIMEOUT = 60
+
+
+def scopes(report):
+    for scope in report["scopes"]:
+        scope.pop("defs", None)
+    return report["scopes"]
+
+
+def reports(text):
+    """The JSON documents that anyopt printed one after the other."""
+    decoder = json.JSONDecoder()
+    result = []
+    position = 0
+    while True:
+        while position < len(text) and text[position].isspace():
+            position += 1
+        if position == len(text):
+            return result
+        report, position = decoder.raw_decode(text, position)
+        result.append(report)
+
+
+def watch(args, inputs, fixture):
+    process = subprocess.Popen([args.anyopt, *inputs, "--analyze", "all", "--watch"], cwd=args.workdir,
+                               stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    lines = queue.Queue()
+    threading.Thread(target=lambda: [lines.put(line) for line in process.stderr], daemon=True).start()
+
+    def wait_for(prefix):
+        while True:
+            try:
+                line = lines.get(timeout=TIMEOUT)
+            except queue.Empty:
+                raise RuntimeError("anyopt did not print '{}' in time".format(prefix))
+            sys.stderr.write(line)
+            if line.startswith(prefix):
+                return line
+
+    try:
+        wait_for("Watching")
+        #Replaced like editors and build tools do, the new file is complete when it appears.
+        temporary = os.path.join(args.workdir, "inc.json.tmp")
+        shutil.copy(fixture("inc_edited.json"), temporary)
+        os.replace(temporary, inputs[1])
+        rebuilt = wait_for("Rebuil")
+    finally:
+        process.terminate()
+        stdout, _ = process.communicate()
+    if not rebuilt.startswith("Rebuilt"):
+        raise RuntimeError("the rebuild failed")
+    return reports(stdout)
+
+
+def check_imported(args, fixture):
+    """Editing a function that another input imports replaces its definition, the importer calls the new one."""
+    inputs = [os.path.join(args.workdir, name) for name in ["main.json", "inc.json"]]
+    shutil.copy(fixture("main.json"), inputs[0])
+    shutil.copy(fixture("inc.json"), inputs[1])
+    watched = watch(args, inputs, fixture)
+
+    result = subprocess.run([args.anyopt, *inputs, "--analyze", "all"], cwd=args.workdir, capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stderr)
+        raise RuntimeError("anyopt failed on the edited files")
+    expected = scopes(json.loads(result.stdout))
+
+    failed = False
+    builds = len(watched) == 2
+    print("builds: {}".format("ok" if builds else "MISMATCH {}".format(len(watched))))
+    failed |= not builds
+    same = bool(watched) and scopes(watched[-1]) == expected
+    print("rebuild: {}".format("ok" if same else "MISMATCH"))
+    failed |= not same
+    return failed
+
+
+CASES = {
+    "imported": check_imported,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--anyopt", required=True, help="anyopt executable")
+    parser.add_argument("--fixtures", required=True, help="directory with the input modules")
+    parser.add_argument("--case", required=True, choices=sorted(CASES), help="check to run")
+    parser.add_argument("--workdir", default=".", help="directory for the watched copies of the inputs")
+    args = parser.parse_args()
+
+    os.makedirs(args.workdir, exist_ok=True)
+    args.workdir = os.path.abspath(args.workdir)
+    fixture = lambda name: os.path.abspath(os.path.join(args.fixtures, name))
+    return 1 if CASES[args.case](args, fixture) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())